@@ -1,176 +1,1833 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/bitmap.h>
 #include <linux/init.h>
 #include <linux/netfilter.h>
 #include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv6.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
-#include <linux/atomic.h>
+#include <linux/seq_file_net.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/smp.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/sort.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
 #include <linux/tcp.h>
 #include <linux/udp.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <net/genetlink.h>
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
 
-static atomic_t tcp_counter = ATOMIC_INIT(0);
-static atomic_t udp_counter = ATOMIC_INIT(0);
-static atomic_t port_counter[65536];
-static atomic_t total_counter = ATOMIC_INIT(0);
+#include "packet_counter_parse.h"
+#include "packet_counter_flows.h"
+#include "packet_counter_export.h"
+#include "packet_counter_genl.h"
 
-static struct nf_hook_ops nfho;
+#define CREATE_TRACE_POINTS
+#include "packet_counter_trace.h"
 
-static struct proc_dir_entry *proc_tcp;
-static struct proc_dir_entry *proc_udp;
+#define PC_NR_PORTS 65536
+
+// Tabella a due livelli: 256 blocchi da 256 contatori, allocati al primo uso
+#define PC_PORT_SHIFT 8
+#define PC_PORT_CHUNK (1 << PC_PORT_SHIFT)
+#define PC_PORT_CHUNKS (PC_NR_PORTS >> PC_PORT_SHIFT)
+
+// Configurazione del modulo, modificabile a caldo dai parametri in
+// /sys/module/packet_counter/parameters e da pcctl. Ogni modifica pubblica una
+// copia nuova con RCU: l'hook legge un solo puntatore per pacchetto, senza lock
+struct pc_config {
+    int priority;               // priorità dei netfilter hook
+    unsigned int protos;        // PC_PROTO_*, i pacchetti degli altri protocolli sono ignorati
+    u16 port_min;               // porte di destinazione contate una per una
+    u16 port_max;
+    unsigned int sample_rate;   // conta un pacchetto ogni sample_rate, per CPU e per hook
+    unsigned int milestone;     // notifica ogni N pacchetti visti da una CPU, 0 per disabilitarla
+    struct rcu_head rcu;
+};
+
+// In uso finché nessuno cambia un parametro, non va mai liberata
+static struct pc_config pc_config_default = {
+    .priority    = NF_IP_PRI_FIRST,
+    .protos      = PC_PROTO_ALL,
+    .port_min    = 0,
+    .port_max    = U16_MAX,
+    .sample_rate = 1,
+    .milestone   = 100,
+};
+
+static struct pc_config __rcu *pc_config = RCU_INITIALIZER(&pc_config_default);
+
+// Serializza le modifiche della configurazione e protegge pc_nets
+static DEFINE_MUTEX(pc_config_lock);
+
+// Classifica dei flussi e istogrammi si spengono solo al caricamento, per
+// esempio per confrontare il solo conteggio con pcount
+static bool flows = true;
+module_param(flows, bool, 0444);
+MODULE_PARM_DESC(flows, "Track the heaviest received flows in top_flows (default on)");
+
+static bool histograms = true;
+module_param(histograms, bool, 0444);
+MODULE_PARM_DESC(histograms, "Keep the length and inter-arrival histograms (default on)");
+
+// Contatori per CPU: ogni core incrementa solo le proprie linee di cache,
+// i totali vengono sommati solo quando si leggono i file in /proc
+struct pc_stats {
+    unsigned long tcp;
+    unsigned long udp;
+    unsigned long total;
+    unsigned long port_lost;                // pacchetti non contati per mancanza di memoria
+    unsigned long sampled;                  // pacchetti visti, per il campionamento
+    unsigned long *port[PC_PORT_CHUNKS];    // blocchi di PC_PORT_CHUNK contatori, NULL finché non servono
+};
+
+// Istogrammi log2: il bucket b raccoglie i valori in [2^(b-1), 2^b), il bucket 0 lo zero;
+// l'ultimo raccoglie anche tutto quello che è più grande
+#define PC_HIST_BUCKETS 32
+
+enum {
+    PC_HIST_TCP,
+    PC_HIST_UDP,
+    PC_HIST_OTHER,
+    PC_HIST_PROTOS,
+};
+
+static const char *const pc_hist_proto_names[PC_HIST_PROTOS] = { "tcp", "udp", "altri" };
+
+// Distribuzioni del traffico ricevuto da una CPU, per protocollo. Gli intervalli
+// tra pacchetti sono misurati sulla CPU, cioè sulla coda di ricezione che la
+// alimenta: è lì che un microburst riempie i buffer
+struct pc_hist {
+    u64 last_ns[PC_HIST_PROTOS];
+    unsigned long len[PC_HIST_PROTOS][PC_HIST_BUCKETS];    // skb->len in byte
+    unsigned long gap[PC_HIST_PROTOS][PC_HIST_BUCKETS];    // ns dal pacchetto precedente
+};
+
+// Un punto di aggancio: famiglia e hook netfilter
+struct pc_hook_desc {
+    const char *name;
+    u8 pf;
+    unsigned int hooknum;
+};
+
+// La priorità è la stessa per tutti, vedi pc_config
+static const struct pc_hook_desc pc_hook_descs[] = {
+    { "ipv4 prerouting",  NFPROTO_IPV4, NF_INET_PRE_ROUTING },
+    { "ipv4 input",       NFPROTO_IPV4, NF_INET_LOCAL_IN },
+    { "ipv4 forward",     NFPROTO_IPV4, NF_INET_FORWARD },
+    { "ipv4 output",      NFPROTO_IPV4, NF_INET_LOCAL_OUT },
+    { "ipv6 prerouting",  NFPROTO_IPV6, NF_INET_PRE_ROUTING },
+    { "ipv6 input",       NFPROTO_IPV6, NF_INET_LOCAL_IN },
+    { "ipv6 forward",     NFPROTO_IPV6, NF_INET_FORWARD },
+    { "ipv6 output",      NFPROTO_IPV6, NF_INET_LOCAL_OUT },
+};
+
+#define PC_NR_HOOKS ARRAY_SIZE(pc_hook_descs)
+
+// Contatori di un hook in un namespace
+struct pc_hook {
+    const struct pc_hook_desc *desc;
+    struct pc_stats __percpu *stats;
+    unsigned long *active_ports;    // porte viste almeno una volta: la lettura visita solo queste
+    struct pc_flows __percpu *flows;    // solo in ingresso, condiviso da IPv4 e IPv6
+    struct pc_hist __percpu *hist;      // idem
+};
+
+// Stato di un namespace di rete: ogni tenant ha i propri hook e contatori,
+// quindi due namespace non condividono mai linee di cache
+struct pc_net {
+    struct pc_hook hooks[PC_NR_HOOKS];
+    struct nf_hook_ops ops[PC_NR_HOOKS];
+    bool ops_registered;
+    struct pc_flows __percpu *flows;
+    struct pc_hist __percpu *hist;
+    struct net *net;
+    struct list_head list;      // in pc_nets
+};
+
+static unsigned int pc_net_id __read_mostly;
+
+siphash_key_t pc_flow_secret __read_mostly;
+
+// Namespace con gli hook registrati, per cambiarne la priorità
+static LIST_HEAD(pc_nets);
+
+static struct pc_net *pc_pernet(struct net *net)
+{
+    return net_generic(net, pc_net_id);
+}
+
+static int pc_net_register(struct pc_net *pn, int priority)
+{
+    int err, i;
+
+    for (i = 0; i < PC_NR_HOOKS; i++)
+    {
+        pn->ops[i].priority = priority;
+    }
+
+    // In caso di errore nessuno resta registrato
+    err = nf_register_net_hooks(pn->net, pn->ops, PC_NR_HOOKS);
+    pn->ops_registered = !err;
+    return err;
+}
+
+static void pc_net_unregister(struct pc_net *pn)
+{
+    if (pn->ops_registered)
+    {
+        nf_unregister_net_hooks(pn->net, pn->ops, PC_NR_HOOKS);
+        pn->ops_registered = false;
+    }
+}
+
+// Netfilter non sposta un hook registrato: in ogni namespace gli hook si
+// tolgono e si rimettono con la nuova priorità. I pacchetti che passano
+// nel frattempo non vengono contati
+static int pc_set_priority(int old, int new)
+{
+    struct pc_net *pn;
+    int err = 0;
+
+    lockdep_assert_held(&pc_config_lock);
+
+    list_for_each_entry(pn, &pc_nets, list)
+    {
+        pc_net_unregister(pn);
+        err = pc_net_register(pn, new);
+        if (err)
+        {
+            break;
+        }
+    }
+    if (!err)
+    {
+        return 0;
+    }
+
+    // Tutti i namespace tornano alla priorità di prima
+    list_for_each_entry_from_reverse(pn, &pc_nets, list)
+    {
+        pc_net_unregister(pn);
+        if (pc_net_register(pn, old))
+        {
+            pr_err("packet_counter: hook non registrati in un namespace\n");
+        }
+    }
+    return err;
+}
+
+// Copia modificabile della configurazione corrente; da pubblicare con
+// pc_config_commit, che rilascia il lock
+static struct pc_config *pc_config_begin(void)
+{
+    struct pc_config *cfg;
+
+    mutex_lock(&pc_config_lock);
+    cfg = kmemdup(rcu_dereference_protected(pc_config, lockdep_is_held(&pc_config_lock)),
+                  sizeof(*cfg), GFP_KERNEL);
+    if (!cfg)
+    {
+        mutex_unlock(&pc_config_lock);
+    }
+    return cfg;
+}
+
+// Con err = 0 pubblica cfg al posto della configurazione corrente, che viene
+// liberata dopo che tutti i pacchetti in volo hanno finito di usarla
+static int pc_config_commit(struct pc_config *cfg, int err)
+{
+    struct pc_config *old = rcu_dereference_protected(pc_config, lockdep_is_held(&pc_config_lock));
+
+    if (!err && cfg->priority != old->priority)
+    {
+        err = pc_set_priority(old->priority, cfg->priority);
+    }
+    if (err)
+    {
+        kfree(cfg);
+        mutex_unlock(&pc_config_lock);
+        return err;
+    }
+
+    rcu_assign_pointer(pc_config, cfg);
+    mutex_unlock(&pc_config_lock);
+
+    if (old != &pc_config_default)
+    {
+        kfree_rcu(old, rcu);
+    }
+    return 0;
+}
+
+// I file in /proc riportano il traffico ricevuto, cioè gli hook di PRE_ROUTING
+static bool pc_hook_is_ingress(const struct pc_hook *hook)
+{
+    return hook->desc->hooknum == NF_INET_PRE_ROUTING;
+}
+
+// Somma i contatori di tutte le CPU; il campo è indicato dal suo offset in struct pc_stats
+static u64 pc_fold(const struct pc_hook *hook, size_t offset)
+{
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        sum += *(unsigned long *)((char *)per_cpu_ptr(hook->stats, cpu) + offset);
+    }
+    return sum;
+}
+
+#define pc_fold_field(hook, field) pc_fold(hook, offsetof(struct pc_stats, field))
+
+// Come pc_fold, ma sommando anche su tutti gli hook di ingresso del namespace
+static u64 pc_fold_ingress(const struct pc_net *pn, size_t offset)
+{
+    u64 sum = 0;
+    int i;
+
+    for (i = 0; i < PC_NR_HOOKS; i++)
+    {
+        if (pc_hook_is_ingress(&pn->hooks[i]))
+        {
+            sum += pc_fold(&pn->hooks[i], offset);
+        }
+    }
+    return sum;
+}
+
+#define pc_fold_ingress_field(pn, field) pc_fold_ingress(pn, offsetof(struct pc_stats, field))
+
+// Fuori dal percorso veloce: somma il totale e lo notifica senza inondare dmesg
+static noinline void pc_milestone(const struct pc_hook *hook)
+{
+    u64 total = pc_fold_field(hook, total);
+
+    trace_packet_counter_milestone(total);
+    printk_ratelimited(KERN_INFO "packet_counter: %s: raggiunti %llu pacchetti totali\n", hook->desc->name, total);
+}
+
+// Fuori dal percorso veloce: alloca il blocco di contatori sul nodo della CPU corrente.
+// Gira in softirq, quindi niente allocazioni che possono dormire
+static noinline unsigned long *pc_port_chunk_alloc(struct pc_stats *stats, unsigned int chunk)
+{
+    unsigned long *counters;
+
+    counters = kzalloc_node(PC_PORT_CHUNK * sizeof(*counters), GFP_ATOMIC | __GFP_NOWARN, numa_node_id());
+    if (!counters)
+    {
+        return NULL;
+    }
+
+    // Pubblica il blocco azzerato per i lettori sulle altre CPU
+    smp_store_release(&stats->port[chunk], counters);
+    return counters;
+}
+
+static inline void pc_port_inc(struct pc_hook *hook, struct pc_stats *stats, unsigned int port)
+{
+    unsigned long *counters = stats->port[port >> PC_PORT_SHIFT];
+
+    if (unlikely(!counters))
+    {
+        counters = pc_port_chunk_alloc(stats, port >> PC_PORT_SHIFT);
+        if (!counters)
+        {
+            stats->port_lost++;
+            return;
+        }
+    }
+    counters[port & (PC_PORT_CHUNK - 1)]++;
+
+    // Scrive la linea condivisa solo la prima volta che la porta compare
+    if (unlikely(!test_bit(port, hook->active_ports)))
+    {
+        set_bit(port, hook->active_ports);
+    }
+}
+
+static inline unsigned int pc_hist_bucket(u64 value)
+{
+    return min_t(unsigned int, fls64(value), PC_HIST_BUCKETS - 1);
+}
+
+static inline void pc_hist_count(struct pc_hist *hist, u8 proto, unsigned int len)
+{
+    unsigned int p = proto == IPPROTO_TCP ? PC_HIST_TCP : proto == IPPROTO_UDP ? PC_HIST_UDP : PC_HIST_OTHER;
+    u64 now = ktime_get_ns();
+
+    hist->len[p][pc_hist_bucket(len)]++;
+
+    // Il primo pacchetto non ha un precedente
+    if (hist->last_ns[p])
+    {
+        hist->gap[p][pc_hist_bucket(now - hist->last_ns[p])]++;
+    }
+    hist->last_ns[p] = now;
+}
+
+static inline unsigned int pc_proto_class(u8 proto)
+{
+    return proto == IPPROTO_TCP ? PC_PROTO_TCP : proto == IPPROTO_UDP ? PC_PROTO_UDP : PC_PROTO_OTHER;
+}
 
 static unsigned int packet_counter_hook(void *priv, struct sk_buff *skb, const struct nf_hook_state *state)
 {
-    struct iphdr *iph;
+    struct pc_hook *hook = priv;
+    const struct pc_config *cfg;
+    struct pc_stats *stats;
+    unsigned int every;
+    unsigned long total;
     int dest_port = 0;
+    int thoff;
+    u8 proto;
 
     if (!skb)
-	{
+    {
+        return NF_ACCEPT;
+    }
+
+    // Gli hook netfilter girano sotto rcu_read_lock: cfg resta valida fino al return
+    cfg = rcu_dereference(pc_config);
+
+    // Nessun altro contesto sulla CPU deve toccare i contatori mentre li aggiorniamo
+    local_bh_disable();
+    stats = this_cpu_ptr(hook->stats);
+
+    // I pacchetti scartati dal campionamento non costano nemmeno il parsing
+    if (cfg->sample_rate > 1 && ++stats->sampled % cfg->sample_rate)
+    {
+        local_bh_enable();
         return NF_ACCEPT;
-	}
+    }
 
-    iph = ip_hdr(skb);
-    
-	if (!iph)
-	{
+    thoff = pc_transport(skb, hook->desc->pf, &proto);
+    if (!(cfg->protos & pc_proto_class(proto)))
+    {
+        local_bh_enable();
         return NF_ACCEPT;
-	}
-    
-	if (iph->protocol == IPPROTO_TCP) 
-	{   //pacchetto TCP
-        struct tcphdr *tcph = (struct tcphdr *)((__u8 *)iph + iph->ihl * 4);   //header, altrimenti non può prendere la porta
-        dest_port = ntohs(tcph->dest);
-        atomic_inc(&tcp_counter);
-        printk(KERN_INFO "TCP dest port: %u\n", dest_port);
-    } 
-	else if (iph->protocol == IPPROTO_UDP) 
-	{    //pacchetto UDP
-        struct udphdr *udph = (struct udphdr *)((__u8 *)iph + iph->ihl * 4);   //header, altrimenti non può prendere la porta
-        dest_port = ntohs(udph->dest);
-        atomic_inc(&udp_counter);
-        printk(KERN_INFO "UDP dest port: %u\n", dest_port);
-    }
-
-    if (dest_port < 65536) 
-	{
-        atomic_inc(&port_counter[dest_port]);
-	}
-
-	int total = atomic_inc_return(&total_counter);
-	if (total % 100 == 0) 
-	{
-        printk(KERN_INFO "packet_counter: raggiunti %d pacchetti totali\n", total);
+    }
+
+    if (proto == IPPROTO_TCP)
+    {   //pacchetto TCP
+        if (thoff >= 0)
+        {
+            dest_port = pc_dest_port(skb, thoff);
+        }
+        stats->tcp++;
+        trace_packet_counter_tcp(skb, dest_port);
+    }
+    else if (proto == IPPROTO_UDP)
+    {    //pacchetto UDP
+        if (thoff >= 0)
+        {
+            dest_port = pc_dest_port(skb, thoff);
+        }
+        stats->udp++;
+        trace_packet_counter_udp(skb, dest_port);
+    }
+
+    if (dest_port >= cfg->port_min && dest_port <= cfg->port_max)
+    {
+        pc_port_inc(hook, stats, dest_port);
+    }
+
+    if (hook->flows && proto)
+    {
+        struct pc_flow_key key;
+
+        if (pc_flow_key_build(skb, hook->desc->pf, thoff, proto, &key))
+        {
+            pc_flow_count(this_cpu_ptr(hook->flows), &key);
+        }
+    }
+
+    if (hook->hist)
+    {
+        pc_hist_count(this_cpu_ptr(hook->hist), proto, skb->len);
+    }
+
+    total = ++stats->total;
+    local_bh_enable();
+
+    // Il traguardo è valutato sul contatore locale, la somma solo quando serve
+    every = cfg->milestone;
+    if (every && total % every == 0)
+    {
+        pc_milestone(hook);
     }
 
     return NF_ACCEPT;
 }
 
+// Somma il contatore di una porta su tutte le CPU che ne hanno allocato il blocco
+static u64 pc_port_fold(const struct pc_hook *hook, unsigned int port)
+{
+    u64 count = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        unsigned long *counters = smp_load_acquire(&per_cpu_ptr(hook->stats, cpu)->port[port >> PC_PORT_SHIFT]);
+
+        if (counters)
+        {
+            count += READ_ONCE(counters[port & (PC_PORT_CHUNK - 1)]);
+        }
+    }
+    return count;
+}
+
+// Unione delle porte viste dagli hook di ingresso (IPv4 e IPv6); 8 KiB, troppi per lo stack
+static unsigned long *pc_ingress_ports(const struct pc_net *pn)
+{
+    unsigned long *active;
+    int h;
+
+    active = bitmap_zalloc(PC_NR_PORTS, GFP_KERNEL);
+    if (!active)
+    {
+        return NULL;
+    }
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        if (pc_hook_is_ingress(&pn->hooks[h]))
+        {
+            bitmap_or(active, active, pn->hooks[h].active_ports, PC_NR_PORTS);
+        }
+    }
+    return active;
+}
+
+static u64 pc_ingress_port_fold(const struct pc_net *pn, unsigned int port)
+{
+    u64 count = 0;
+    int h;
+
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        if (pc_hook_is_ingress(&pn->hooks[h]))
+        {
+            count += pc_port_fold(&pn->hooks[h], port);
+        }
+    }
+    return count;
+}
+
 static int port_show(struct seq_file *m, void *v)
 {
+    struct pc_net *pn = pc_pernet(seq_file_single_net(m));
+    unsigned long *active;
+    unsigned int i;
+    u64 lost;
+
+    active = pc_ingress_ports(pn);
+    if (!active)
+    {
+        return -ENOMEM;
+    }
+
+    // Il costo dipende dalle porte usate, non dalle 65536 possibili
+    for_each_set_bit(i, active, PC_NR_PORTS)
+    {
+        u64 count = pc_ingress_port_fold(pn, i);
+
+        if (count > 0)
+        {
+            seq_printf(m, "Porta %u: %llu pacchetti\n", i, count);
+        }
+    }
+    bitmap_free(active);
+
+    lost = pc_fold_ingress_field(pn, port_lost);
+    if (lost)
+    {
+        seq_printf(m, "Non contati (memoria esaurita): %llu pacchetti\n", lost);
+    }
+    return 0;
+}
+
+static int tcp_show(struct seq_file *m, void *v)
+{
+    struct pc_net *pn = pc_pernet(seq_file_single_net(m));
+
+    seq_printf(m, "%llu\n", pc_fold_ingress_field(pn, tcp));
+    return 0;
+}
+
+static int udp_show(struct seq_file *m, void *v)
+{
+    struct pc_net *pn = pc_pernet(seq_file_single_net(m));
+
+    seq_printf(m, "%llu\n", pc_fold_ingress_field(pn, udp));
+    return 0;
+}
+
+// Una riga per hook: un pacchetto inoltrato compare sia in prerouting che in forward
+static int hooks_show(struct seq_file *m, void *v)
+{
+    struct pc_net *pn = pc_pernet(seq_file_single_net(m));
     int i;
-    for (i = 0; i < 65536; ++i) 
-	{
-        int count = atomic_read(&port_counter[i]);
-        if (count > 0) 
-		{
-            seq_printf(m, "Porta %d: %d pacchetti\n", i, count);
-		}
+
+    seq_printf(m, "%-16s %12s %12s %12s\n", "hook", "tcp", "udp", "totale");
+    for (i = 0; i < PC_NR_HOOKS; i++)
+    {
+        const struct pc_hook *hook = &pn->hooks[i];
+
+        seq_printf(m, "%-16s %12llu %12llu %12llu\n", hook->desc->name,
+                   pc_fold_field(hook, tcp), pc_fold_field(hook, udp), pc_fold_field(hook, total));
     }
     return 0;
 }
 
-static int port_open(struct inode *inode, struct file *file)
+// Stima di un flusso su tutto il namespace: sommare gli sketch delle CPU
+// dà lo sketch di tutto il traffico, di cui si prende il minimo sulle righe
+static unsigned long pc_flow_estimate(const struct pc_net *pn, u64 hash)
 {
-    return single_open(file, port_show, NULL);
+    unsigned long est = ULONG_MAX;
+    int cpu, r;
+
+    for (r = 0; r < PC_CMS_DEPTH; r++)
+    {
+        unsigned int slot = pc_flow_slot(hash, r);
+        unsigned long sum = 0;
+
+        for_each_possible_cpu(cpu)
+        {
+            sum += READ_ONCE(per_cpu_ptr(pn->flows, cpu)->cms[r][slot]);
+        }
+        est = min(est, sum);
+    }
+    return est;
 }
 
-static int tcp_show(struct seq_file *m, void *v)
+// Copia la classifica di una CPU, riprovando se nel frattempo è cambiata
+static unsigned int pc_flow_top_copy(struct pc_flows *fl, struct pc_flow_entry *dst)
 {
-    seq_printf(m, "%d\n", atomic_read(&tcp_counter));
+    unsigned int seq, len;
+
+    do
+    {
+        seq = read_seqcount_begin(&fl->seq);
+        len = min_t(unsigned int, READ_ONCE(fl->top_len), PC_TOPK);
+        memcpy(dst, fl->top, len * sizeof(*dst));
+    } while (read_seqcount_retry(&fl->seq, seq));
+    return len;
+}
+
+static int pc_flow_cmp_key(const void *a, const void *b)
+{
+    const struct pc_flow_entry *ea = a, *eb = b;
+
+    return memcmp(&ea->key, &eb->key, sizeof(ea->key));
+}
+
+// Ordine decrescente di pacchetti
+static int pc_flow_cmp_count(const void *a, const void *b)
+{
+    const struct pc_flow_entry *ea = a, *eb = b;
+
+    if (ea->count != eb->count)
+    {
+        return ea->count < eb->count ? 1 : -1;
+    }
     return 0;
 }
 
-static int udp_show(struct seq_file *m, void *v)
+static void pc_flow_format(char *buf, size_t size, u8 pf, const struct in6_addr *addr, __be16 port)
+{
+    if (pf == NFPROTO_IPV4)
+    {
+        snprintf(buf, size, "%pI4:%u", &addr->s6_addr32[3], ntohs(port));
+    }
+    else
+    {
+        snprintf(buf, size, "[%pI6c]:%u", addr, ntohs(port));
+    }
+}
+
+static void pc_flow_show(struct seq_file *m, const struct pc_flow_entry *e)
 {
-    seq_printf(m, "%d\n", atomic_read(&udp_counter));
+    char proto[8], src[48], dst[48];
+
+    switch (e->key.proto)
+    {
+    case IPPROTO_TCP:
+        strscpy(proto, "tcp", sizeof(proto));
+        break;
+    case IPPROTO_UDP:
+        strscpy(proto, "udp", sizeof(proto));
+        break;
+    case IPPROTO_ICMP:
+        strscpy(proto, "icmp", sizeof(proto));
+        break;
+    case IPPROTO_ICMPV6:
+        strscpy(proto, "icmp6", sizeof(proto));
+        break;
+    default:
+        snprintf(proto, sizeof(proto), "%u", e->key.proto);
+    }
+    pc_flow_format(src, sizeof(src), e->key.pf, &e->key.saddr, e->key.sport);
+    pc_flow_format(dst, sizeof(dst), e->key.pf, &e->key.daddr, e->key.dport);
+
+    seq_printf(m, "%-6s %-47s %-47s %12lu\n", proto, src, dst, e->count);
+}
+
+// I flussi più pesanti ricevuti dal namespace, stimati dagli sketch
+static int top_flows_show(struct seq_file *m, void *v)
+{
+    struct pc_net *pn = pc_pernet(seq_file_single_net(m));
+    struct pc_flow_entry *cand;
+    unsigned int n = 0, nr = 0, i;
+    int cpu;
+
+    cand = kvmalloc_array(nr_cpu_ids * PC_TOPK, sizeof(*cand), GFP_KERNEL);
+    if (!cand)
+    {
+        return -ENOMEM;
+    }
+
+    for_each_possible_cpu(cpu)
+    {
+        n += pc_flow_top_copy(per_cpu_ptr(pn->flows, cpu), cand + n);
+    }
+
+    // Un flusso distribuito da RSS può essere in classifica su più CPU:
+    // ogni candidato compare una volta, con la stima di tutto il namespace
+    sort(cand, n, sizeof(*cand), pc_flow_cmp_key, NULL);
+    for (i = 0; i < n; i++)
+    {
+        if (nr && !pc_flow_cmp_key(&cand[nr - 1], &cand[i]))
+        {
+            continue;
+        }
+        cand[nr] = cand[i];
+        cand[nr].count = pc_flow_estimate(pn, cand[i].hash);
+        nr++;
+    }
+    sort(cand, nr, sizeof(*cand), pc_flow_cmp_count, NULL);
+
+    seq_printf(m, "%-6s %-47s %-47s %12s\n", "proto", "sorgente", "destinazione", "pacchetti");
+    for (i = 0; i < min_t(unsigned int, nr, PC_TOPK); i++)
+    {
+        pc_flow_show(m, &cand[i]);
+    }
+
+    kvfree(cand);
     return 0;
 }
 
-static int tcp_open(struct inode *inode, struct file *file)
+// Somma un bucket su tutte le CPU; il campo è indicato dal suo offset in struct pc_hist
+static u64 pc_hist_fold(const struct pc_net *pn, size_t offset)
 {
-    return single_open(file, tcp_show, NULL);
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        sum += READ_ONCE(*(unsigned long *)((char *)per_cpu_ptr(pn->hist, cpu) + offset));
+    }
+    return sum;
 }
 
-static int udp_open(struct inode *inode, struct file *file)
+// Una tabella per istogramma, con le sole righe non vuote
+static void pc_hist_show(struct seq_file *m, const struct pc_net *pn, const char *title,
+                         size_t offset, const char *unit)
 {
-    return single_open(file, udp_show, NULL);
+    u64 counts[PC_HIST_PROTOS];
+    unsigned int b, p;
+
+    seq_printf(m, "%s\n%-24s", title, unit);
+    for (p = 0; p < PC_HIST_PROTOS; p++)
+    {
+        seq_printf(m, " %12s", pc_hist_proto_names[p]);
+    }
+    seq_putc(m, '\n');
+
+    for (b = 0; b < PC_HIST_BUCKETS; b++)
+    {
+        u64 any = 0;
+
+        for (p = 0; p < PC_HIST_PROTOS; p++)
+        {
+            counts[p] = pc_hist_fold(pn, offset + (p * PC_HIST_BUCKETS + b) * sizeof(unsigned long));
+            any |= counts[p];
+        }
+        if (!any)
+        {
+            continue;
+        }
+
+        if (b == 0)
+        {
+            seq_printf(m, "%-24s", "0");
+        }
+        else if (b == PC_HIST_BUCKETS - 1)
+        {
+            seq_printf(m, ">= %-21llu", 1ULL << (b - 1));
+        }
+        else
+        {
+            char range[24];
+
+            snprintf(range, sizeof(range), "%llu-%llu", 1ULL << (b - 1), (1ULL << b) - 1);
+            seq_printf(m, "%-24s", range);
+        }
+        for (p = 0; p < PC_HIST_PROTOS; p++)
+        {
+            seq_printf(m, " %12llu", counts[p]);
+        }
+        seq_putc(m, '\n');
+    }
 }
 
-static const struct proc_ops tcp_proc_fops = {
-    .proc_open    = tcp_open,
-    .proc_read    = seq_read,
-    .proc_lseek   = seq_lseek,
-    .proc_release = single_release,
-};
+// Lunghezze e intervalli di arrivo del traffico ricevuto dal namespace
+static int histograms_show(struct seq_file *m, void *v)
+{
+    struct pc_net *pn = pc_pernet(seq_file_single_net(m));
 
-static const struct proc_ops udp_proc_fops = {
-    .proc_open    = udp_open,
-    .proc_read    = seq_read,
-    .proc_lseek   = seq_lseek,
-    .proc_release = single_release,
-};
+    pc_hist_show(m, pn, "Lunghezza dei pacchetti", offsetof(struct pc_hist, len), "byte");
+    seq_putc(m, '\n');
+    pc_hist_show(m, pn, "Intervallo dal pacchetto precedente sulla stessa CPU",
+                 offsetof(struct pc_hist, gap), "ns");
+    return 0;
+}
 
-static const struct proc_ops port_proc_fops = {
-    .proc_open    = port_open,
-    .proc_read    = seq_read,
-    .proc_lseek   = seq_lseek,
-    .proc_release = single_release,
+// Istantanea binaria di /proc/net/packet_counter/counters, vedi packet_counter_export.h
+struct pc_snapshot {
+    void *buf;          // vmalloc_user: azzerato e mappabile in spazio utente
+    size_t size;        // byte validi
+    size_t alloc_size;  // multiplo di PAGE_SIZE
 };
 
-static int __init packet_counter_init(void)
+static struct pc_snapshot *pc_snapshot_build(struct pc_net *pn)
 {
-    // Configura il Netfilter hook
-    nfho.hook = packet_counter_hook;
-    nfho.hooknum = NF_INET_PRE_ROUTING;  // intercetta i pacchetti prima del routing
-    nfho.pf = PF_INET;                   // famiglia IPv4
-    nfho.priority = NF_IP_PRI_FIRST;    // priorità alta
+    struct pc_export_header *hdr;
+    struct pc_export_hook *ehook;
+    struct pc_export_port *eport;
+    struct pc_snapshot *snap;
+    unsigned long *active;
+    unsigned int nr_ports, i;
+    size_t size;
+    int h;
 
-    // Registra il Netfilter hook
-    nf_register_net_hook(&init_net, &nfho);
+    active = pc_ingress_ports(pn);
+    if (!active)
+    {
+        return NULL;
+    }
 
-    // Crea le entry in /proc
-    proc_tcp = proc_create("tcp_packets", 0444, NULL, &tcp_proc_fops);
-    proc_udp = proc_create("udp_packets", 0444, NULL, &udp_proc_fops);
-    proc_create("port_packets", 0444, NULL, &port_proc_fops);
+    // Una porta attiva in una CPU ha sempre almeno un pacchetto: al più nr_ports voci
+    nr_ports = bitmap_weight(active, PC_NR_PORTS);
+    size = sizeof(*hdr) + PC_NR_HOOKS * sizeof(*ehook) + nr_ports * sizeof(*eport);
 
-    printk(KERN_INFO "packet_counter: modulo caricato\n");
+    snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+    if (!snap)
+    {
+        goto err_active;
+    }
+    snap->alloc_size = PAGE_ALIGN(size);
+    snap->buf = vmalloc_user(snap->alloc_size);
+    if (!snap->buf)
+    {
+        goto err_snap;
+    }
+
+    hdr = snap->buf;
+    hdr->magic = PC_EXPORT_MAGIC;
+    hdr->version = PC_EXPORT_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->timestamp_ns = ktime_get_real_ns();
+    hdr->nr_hooks = PC_NR_HOOKS;
+    hdr->hooks_off = sizeof(*hdr);
+    hdr->hook_size = sizeof(*ehook);
+    hdr->ports_off = hdr->hooks_off + PC_NR_HOOKS * sizeof(*ehook);
+    hdr->port_size = sizeof(*eport);
+
+    ehook = snap->buf + hdr->hooks_off;
+    for (h = 0; h < PC_NR_HOOKS; h++, ehook++)
+    {
+        const struct pc_hook *hook = &pn->hooks[h];
+
+        ehook->pf = hook->desc->pf;
+        ehook->hooknum = hook->desc->hooknum;
+        ehook->tcp = pc_fold_field(hook, tcp);
+        ehook->udp = pc_fold_field(hook, udp);
+        ehook->total = pc_fold_field(hook, total);
+        ehook->port_lost = pc_fold_field(hook, port_lost);
+    }
+
+    eport = snap->buf + hdr->ports_off;
+    for_each_set_bit(i, active, PC_NR_PORTS)
+    {
+        u64 count = pc_ingress_port_fold(pn, i);
+
+        // La bitmap può essere cresciuta dopo bitmap_weight
+        if (!count || hdr->nr_ports == nr_ports)
+        {
+            continue;
+        }
+        eport->port = i;
+        eport->packets = count;
+        eport++;
+        hdr->nr_ports++;
+    }
+
+    hdr->size = hdr->ports_off + hdr->nr_ports * sizeof(*eport);
+    snap->size = hdr->size;
+    bitmap_free(active);
+    return snap;
+
+err_snap:
+    kfree(snap);
+err_active:
+    bitmap_free(active);
+    return NULL;
+}
+
+// L'istantanea si prende all'apertura: read e mmap vedono sempre gli stessi valori
+static int counters_open(struct inode *inode, struct file *file)
+{
+    struct pc_snapshot *snap;
+
+    snap = pc_snapshot_build(pc_pernet(pde_data(inode)));
+    if (!snap)
+    {
+        return -ENOMEM;
+    }
+    file->private_data = snap;
     return 0;
 }
 
-static void __exit packet_counter_exit(void)
+static ssize_t counters_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
 {
-    // Rimuove il Netfilter hook
-    nf_unregister_net_hook(&init_net, &nfho);
+    struct pc_snapshot *snap = file->private_data;
 
-    // Rimuove le entry in /proc
-    if (proc_tcp) 
-	{
-        proc_remove(proc_tcp);
-	}
-    if (proc_udp) 
-	{
-        proc_remove(proc_udp);
-	}
-		remove_proc_entry("port_packets", NULL);
+    return simple_read_from_buffer(buf, count, ppos, snap->buf, snap->size);
+}
 
-    printk(KERN_INFO "packet_counter: modulo rimosso\n");
+// Solo in lettura e dall'inizio dell'istantanea
+static int counters_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct pc_snapshot *snap = file->private_data;
+
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start > snap->alloc_size)
+    {
+        return -EINVAL;
+    }
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+    vm_flags_clear(vma, VM_MAYWRITE);
+
+    return remap_vmalloc_range(vma, snap->buf, 0);
 }
 
-module_init(packet_counter_init);
-module_exit(packet_counter_exit);
+static int counters_release(struct inode *inode, struct file *file)
+{
+    struct pc_snapshot *snap = file->private_data;
 
-MODULE_LICENSE("GPL");
+    vfree(snap->buf);
+    kfree(snap);
+    return 0;
+}
 
+static const struct proc_ops counters_proc_ops = {
+    .proc_open    = counters_open,
+    .proc_read    = counters_read,
+    .proc_mmap    = counters_mmap,
+    .proc_lseek   = default_llseek,
+    .proc_release = counters_release,
+};
 
+// Famiglia generic netlink: vedi packet_counter_genl.h
+static struct genl_family pc_genl_family;
 
+// Stato di un dump, tra una chiamata di dumpit e la successiva
+struct pc_dump {
+    struct pc_snapshot *snap;
+    unsigned int next;      // prossimo record: prima gli hook, poi le porte
+    u16 port_min;
+    u16 port_max;
+};
+
+static int pc_genl_dump_start(struct netlink_callback *cb)
+{
+    const struct genl_dumpit_info *info = genl_dumpit_info(cb);
+    struct nlattr **attrs = info->info.attrs;
+    struct pc_dump *dump;
+
+    dump = kzalloc(sizeof(*dump), GFP_KERNEL);
+    if (!dump)
+    {
+        return -ENOMEM;
+    }
+    dump->port_min = attrs[PC_ATTR_PORT_MIN] ? nla_get_u16(attrs[PC_ATTR_PORT_MIN]) : 0;
+    dump->port_max = attrs[PC_ATTR_PORT_MAX] ? nla_get_u16(attrs[PC_ATTR_PORT_MAX]) : U16_MAX;
+
+    // Un'unica istantanea per tutto il dump, anche se servono più recvmsg
+    dump->snap = pc_snapshot_build(pc_pernet(sock_net(cb->skb->sk)));
+    if (!dump->snap)
+    {
+        kfree(dump);
+        return -ENOMEM;
+    }
+    cb->args[0] = (long)dump;
+    return 0;
+}
+
+static int pc_genl_dump_done(struct netlink_callback *cb)
+{
+    struct pc_dump *dump = (struct pc_dump *)cb->args[0];
+
+    if (dump)
+    {
+        vfree(dump->snap->buf);
+        kfree(dump->snap);
+        kfree(dump);
+    }
+    return 0;
+}
+
+static int pc_genl_put_hook(struct sk_buff *skb, const struct pc_export_hook *ehook)
+{
+    struct nlattr *nest;
+
+    nest = nla_nest_start(skb, PC_ATTR_HOOK);
+    if (!nest ||
+        nla_put_u8(skb, PC_HOOK_ATTR_PF, ehook->pf) ||
+        nla_put_u8(skb, PC_HOOK_ATTR_HOOKNUM, ehook->hooknum) ||
+        nla_put_u64_64bit(skb, PC_HOOK_ATTR_TCP, ehook->tcp, PC_HOOK_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PC_HOOK_ATTR_UDP, ehook->udp, PC_HOOK_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PC_HOOK_ATTR_TOTAL, ehook->total, PC_HOOK_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, PC_HOOK_ATTR_PORT_LOST, ehook->port_lost, PC_HOOK_ATTR_PAD))
+    {
+        return -EMSGSIZE;
+    }
+    nla_nest_end(skb, nest);
+    return 0;
+}
+
+static int pc_genl_put_port(struct sk_buff *skb, const struct pc_export_port *eport)
+{
+    struct nlattr *nest;
+
+    nest = nla_nest_start(skb, PC_ATTR_PORT);
+    if (!nest ||
+        nla_put_u16(skb, PC_PORT_ATTR_PORT, eport->port) ||
+        nla_put_u64_64bit(skb, PC_PORT_ATTR_PACKETS, eport->packets, PC_PORT_ATTR_PAD))
+    {
+        return -EMSGSIZE;
+    }
+    nla_nest_end(skb, nest);
+    return 0;
+}
+
+// Riempie l'skb con quanti più record possibile; netlink richiama dumpit
+// finché non restituisce 0, quindi un dump costa poche recvmsg
+static int pc_genl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+    struct pc_dump *dump = (struct pc_dump *)cb->args[0];
+    const struct pc_export_header *hdr = dump->snap->buf;
+    const struct pc_export_hook *hooks = dump->snap->buf + hdr->hooks_off;
+    const struct pc_export_port *ports = dump->snap->buf + hdr->ports_off;
+    unsigned int nr = hdr->nr_hooks + hdr->nr_ports;
+    void *msg;
+    int err;
+
+    for (; dump->next < nr; dump->next++)
+    {
+        const struct pc_export_port *eport = NULL;
+
+        if (dump->next >= hdr->nr_hooks)
+        {
+            eport = &ports[dump->next - hdr->nr_hooks];
+            if (eport->port < dump->port_min || eport->port > dump->port_max)
+            {
+                continue;
+            }
+        }
+
+        msg = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+                          &pc_genl_family, NLM_F_MULTI, PC_CMD_DUMP);
+        if (!msg)
+        {
+            break;
+        }
+
+        err = nla_put_u64_64bit(skb, PC_ATTR_TIMESTAMP, hdr->timestamp_ns, PC_ATTR_PAD);
+        if (!err)
+        {
+            err = eport ? pc_genl_put_port(skb, eport) : pc_genl_put_hook(skb, &hooks[dump->next]);
+        }
+        if (err)
+        {
+            genlmsg_cancel(skb, msg);
+            break;
+        }
+        genlmsg_end(skb, msg);
+    }
+
+    return skb->len;
+}
+
+// Ogni CPU azzera i propri contatori, in contesto di processo e con i bottom
+// half disabilitati: nessun hook della stessa CPU può trovarsi a metà di un
+// aggiornamento, quindi la sezione di scrittura della classifica non si
+// annida in quella di pc_flow_top_insert e un lettore di top_flows ritenta
+// invece di vedere metà classifica vecchia e metà nuova
+static int pc_reset_cpu(void *info)
+{
+    struct pc_net *pn = info;
+    struct pc_flows *fl;
+    int h, i;
+
+    local_bh_disable();
+
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        struct pc_stats *stats = this_cpu_ptr(pn->hooks[h].stats);
+
+        stats->tcp = 0;
+        stats->udp = 0;
+        stats->total = 0;
+        stats->port_lost = 0;
+        for (i = 0; i < PC_PORT_CHUNKS; i++)
+        {
+            if (stats->port[i])
+            {
+                memset(stats->port[i], 0, PC_PORT_CHUNK * sizeof(*stats->port[i]));
+            }
+        }
+    }
+
+    fl = this_cpu_ptr(pn->flows);
+    write_seqcount_begin(&fl->seq);
+    memset(fl->cms, 0, PC_CMS_DEPTH * sizeof(*fl->cms));
+    fl->top_len = 0;
+    fl->top_min = 0;
+    write_seqcount_end(&fl->seq);
+
+    memset(this_cpu_ptr(pn->hist), 0, sizeof(struct pc_hist));
+
+    local_bh_enable();
+    return 0;
+}
+
+static int pc_genl_reset(struct sk_buff *skb, struct genl_info *info)
+{
+    struct pc_net *pn = pc_pernet(genl_info_net(info));
+    int cpu;
+
+    cpus_read_lock();
+    for_each_online_cpu(cpu)
+    {
+        smp_call_on_cpu(cpu, pc_reset_cpu, pn, false);
+    }
+    cpus_read_unlock();
+    return 0;
+}
+
+static int pc_genl_get_config(struct sk_buff *skb, struct genl_info *info)
+{
+    struct pc_config cfg;
+    struct sk_buff *reply;
+    void *msg;
+
+    rcu_read_lock();
+    cfg = *rcu_dereference(pc_config);
+    rcu_read_unlock();
+
+    reply = genlmsg_new(4 * nla_total_size(sizeof(u32)) + 2 * nla_total_size(sizeof(u16)), GFP_KERNEL);
+    if (!reply)
+    {
+        return -ENOMEM;
+    }
+
+    msg = genlmsg_put_reply(reply, info, &pc_genl_family, 0, PC_CMD_GET_CONFIG);
+    if (!msg ||
+        nla_put_u32(reply, PC_ATTR_MILESTONE, cfg.milestone) ||
+        nla_put_s32(reply, PC_ATTR_PRIORITY, cfg.priority) ||
+        nla_put_u32(reply, PC_ATTR_PROTOCOLS, cfg.protos) ||
+        nla_put_u32(reply, PC_ATTR_SAMPLE_RATE, cfg.sample_rate) ||
+        nla_put_u16(reply, PC_ATTR_PORT_MIN, cfg.port_min) ||
+        nla_put_u16(reply, PC_ATTR_PORT_MAX, cfg.port_max))
+    {
+        nlmsg_free(reply);
+        return -EMSGSIZE;
+    }
+    genlmsg_end(reply, msg);
+
+    return genlmsg_reply(reply, info);
+}
+
+static int pc_genl_set_config(struct sk_buff *skb, struct genl_info *info)
+{
+    struct nlattr **attrs = info->attrs;
+    struct pc_config *cfg;
+    int err = 0;
+
+    cfg = pc_config_begin();
+    if (!cfg)
+    {
+        return -ENOMEM;
+    }
+
+    if (attrs[PC_ATTR_MILESTONE])
+    {
+        cfg->milestone = nla_get_u32(attrs[PC_ATTR_MILESTONE]);
+    }
+    if (attrs[PC_ATTR_PRIORITY])
+    {
+        cfg->priority = nla_get_s32(attrs[PC_ATTR_PRIORITY]);
+    }
+    if (attrs[PC_ATTR_PROTOCOLS])
+    {
+        cfg->protos = nla_get_u32(attrs[PC_ATTR_PROTOCOLS]);
+    }
+    if (attrs[PC_ATTR_SAMPLE_RATE])
+    {
+        cfg->sample_rate = nla_get_u32(attrs[PC_ATTR_SAMPLE_RATE]);
+    }
+    if (attrs[PC_ATTR_PORT_MIN])
+    {
+        cfg->port_min = nla_get_u16(attrs[PC_ATTR_PORT_MIN]);
+    }
+    if (attrs[PC_ATTR_PORT_MAX])
+    {
+        cfg->port_max = nla_get_u16(attrs[PC_ATTR_PORT_MAX]);
+    }
+    if (cfg->port_min > cfg->port_max)
+    {
+        NL_SET_ERR_MSG(info->extack, "port range is empty");
+        err = -EINVAL;
+    }
+
+    return pc_config_commit(cfg, err);
+}
+
+static const struct nla_policy pc_genl_policy[PC_ATTR_MAX + 1] = {
+    [PC_ATTR_PORT_MIN]  = { .type = NLA_U16 },
+    [PC_ATTR_PORT_MAX]  = { .type = NLA_U16 },
+    [PC_ATTR_MILESTONE] = { .type = NLA_U32 },
+    [PC_ATTR_PRIORITY]  = { .type = NLA_S32 },
+    [PC_ATTR_PROTOCOLS] = NLA_POLICY_MASK(NLA_U32, PC_PROTO_ALL),
+    [PC_ATTR_SAMPLE_RATE] = NLA_POLICY_MIN(NLA_U32, 1),
+};
+
+static const struct genl_ops pc_genl_ops[] = {
+    {
+        .cmd    = PC_CMD_DUMP,
+        .start  = pc_genl_dump_start,
+        .dumpit = pc_genl_dump,
+        .done   = pc_genl_dump_done,
+    },
+    {
+        .cmd    = PC_CMD_RESET,
+        .doit   = pc_genl_reset,
+        .flags  = GENL_UNS_ADMIN_PERM,
+    },
+    {
+        .cmd    = PC_CMD_GET_CONFIG,
+        .doit   = pc_genl_get_config,
+    },
+    {
+        // La configurazione vale per tutti i namespace
+        .cmd    = PC_CMD_SET_CONFIG,
+        .doit   = pc_genl_set_config,
+        .flags  = GENL_ADMIN_PERM,
+    },
+};
+
+static struct genl_family pc_genl_family __ro_after_init = {
+    .name     = PC_GENL_NAME,
+    .version  = PC_GENL_VERSION,
+    .maxattr  = PC_ATTR_MAX,
+    .policy   = pc_genl_policy,
+    .netnsok  = true,
+    .module   = THIS_MODULE,
+    .ops      = pc_genl_ops,
+    .n_ops    = ARRAY_SIZE(pc_genl_ops),
+    .resv_start_op = PC_CMD_SET_CONFIG + 1,
+};
+
+// Kfunc per i programmi BPF di tracing: i contatori di un namespace senza
+// passare da /proc e senza allocazioni. hook è l'indice in pc_hook_descs
+// (IPv4 da 0 a 3, IPv6 da 4 a 7, nell'ordine NF_INET_*), lo stesso di pcount.
+// I kfunc lavorano su una copia dell'hook, con i puntatori letti una volta
+// sola: pc_net_exit li azzera e li libera solo dopo un periodo di grazia RCU,
+// quindi restano validi fino alla fine della sezione RCU del chiamante
+static bool pc_kfunc_hook(struct net *net, u32 hook, struct pc_hook *h)
+{
+    const struct pc_hook *src;
+
+    if (hook >= PC_NR_HOOKS)
+    {
+        return false;
+    }
+    src = &pc_pernet(net)->hooks[hook];
+
+    *h = (struct pc_hook) {
+        .desc = src->desc,
+        .stats = READ_ONCE(src->stats),
+        .active_ports = READ_ONCE(src->active_ports),
+    };
+    // NULL quando il namespace è in fase di distruzione
+    return h->stats && h->active_ports;
+}
+
+__bpf_kfunc_start_defs();
+
+// Pacchetti visti da un hook su una porta di destinazione, sommati sulle CPU
+__bpf_kfunc u64 bpf_pc_port_packets(struct net *net, u32 hook, u32 port)
+{
+    struct pc_hook h;
+
+    if (!pc_kfunc_hook(net, hook, &h) || port >= PC_NR_PORTS)
+    {
+        return 0;
+    }
+    return pc_port_fold(&h, port);
+}
+
+// Totali di un hook, nel formato di /proc/net/packet_counter/counters
+__bpf_kfunc int bpf_pc_hook_read(struct net *net, u32 hook, struct pc_export_hook *out, u32 out__sz)
+{
+    struct pc_hook h;
+
+    if (!pc_kfunc_hook(net, hook, &h) || out__sz < sizeof(*out))
+    {
+        return -EINVAL;
+    }
+    *out = (struct pc_export_hook) {
+        .pf = h.desc->pf,
+        .hooknum = h.desc->hooknum,
+        .tcp = pc_fold_field(&h, tcp),
+        .udp = pc_fold_field(&h, udp),
+        .total = pc_fold_field(&h, total),
+        .port_lost = pc_fold_field(&h, port_lost),
+    };
+    return 0;
+}
+
+// Porte attive di un hook da start in poi, in ordine crescente: riempie al più
+// ports__sz byte di ports e restituisce quante porte ha scritto, 0 alla fine.
+// Il giro successivo riparte dalla porta dopo l'ultima restituita
+__bpf_kfunc int bpf_pc_ports_read(struct net *net, u32 hook, u32 start,
+                                  struct pc_export_port *ports, u32 ports__sz)
+{
+    unsigned int max = ports__sz / sizeof(*ports);
+    unsigned int port, n = 0;
+    struct pc_hook h;
+
+    if (!pc_kfunc_hook(net, hook, &h))
+    {
+        return -EINVAL;
+    }
+
+    for (port = find_next_bit(h.active_ports, PC_NR_PORTS, start);
+         port < PC_NR_PORTS && n < max;
+         port = find_next_bit(h.active_ports, PC_NR_PORTS, port + 1))
+    {
+        ports[n++] = (struct pc_export_port) {
+            .port = port,
+            .packets = pc_port_fold(&h, port),
+        };
+    }
+    return n;
+}
+
+__bpf_kfunc_end_defs();
+
+// KF_RCU: il namespace arriva da un argomento del punto di tracing o da una
+// lettura sotto RCU, quindi è vivo per tutta la chiamata
+BTF_SET8_START(pc_kfunc_ids)
+BTF_ID_FLAGS(func, bpf_pc_port_packets, KF_RCU)
+BTF_ID_FLAGS(func, bpf_pc_hook_read, KF_RCU)
+BTF_ID_FLAGS(func, bpf_pc_ports_read, KF_RCU)
+BTF_SET8_END(pc_kfunc_ids)
+
+static const struct btf_kfunc_id_set pc_kfunc_set = {
+    .owner = THIS_MODULE,
+    .set   = &pc_kfunc_ids,
+};
+
+static void pc_flows_free(struct pc_net *pn)
+{
+    int cpu;
+
+    if (!pn->flows)
+    {
+        return;
+    }
+    for_each_possible_cpu(cpu)
+    {
+        kvfree(per_cpu_ptr(pn->flows, cpu)->cms);
+    }
+    free_percpu(pn->flows);
+    pn->flows = NULL;
+}
+
+// Memoria fissa, decisa al caricamento: PC_CMS_DEPTH * PC_CMS_WIDTH contatori
+// per CPU, sul nodo della CPU che li aggiorna
+static int pc_flows_alloc(struct pc_net *pn)
+{
+    int cpu;
+
+    pn->flows = alloc_percpu(struct pc_flows);
+    if (!pn->flows)
+    {
+        return -ENOMEM;
+    }
+    for_each_possible_cpu(cpu)
+    {
+        struct pc_flows *fl = per_cpu_ptr(pn->flows, cpu);
+
+        seqcount_init(&fl->seq);
+        fl->cms = kvzalloc_node(PC_CMS_DEPTH * sizeof(*fl->cms), GFP_KERNEL, cpu_to_node(cpu));
+        if (!fl->cms)
+        {
+            pc_flows_free(pn);
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static void pc_hook_stats_free(struct pc_stats __percpu *stats)
+{
+    int cpu, i;
+
+    if (!stats)
+    {
+        return;
+    }
+    for_each_possible_cpu(cpu)
+    {
+        for (i = 0; i < PC_PORT_CHUNKS; i++)
+        {
+            kfree(per_cpu_ptr(stats, cpu)->port[i]);
+        }
+    }
+    free_percpu(stats);
+}
+
+static void pc_stats_free(struct pc_net *pn)
+{
+    int h;
+
+    pc_flows_free(pn);
+    free_percpu(pn->hist);
+    pn->hist = NULL;
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        struct pc_hook *hook = &pn->hooks[h];
+
+        hook->flows = NULL;
+        hook->hist = NULL;
+        bitmap_free(hook->active_ports);
+        hook->active_ports = NULL;
+        pc_hook_stats_free(hook->stats);
+        hook->stats = NULL;
+    }
+}
+
+// Solo la parte fissa dei contatori: i blocchi delle porte arrivano con il traffico
+static int pc_stats_alloc(struct pc_net *pn)
+{
+    int h;
+
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        struct pc_hook *hook = &pn->hooks[h];
+
+        hook->desc = &pc_hook_descs[h];
+        hook->stats = alloc_percpu(struct pc_stats);
+        hook->active_ports = bitmap_zalloc(PC_NR_PORTS, GFP_KERNEL);
+        if (!hook->stats || !hook->active_ports)
+        {
+            pc_stats_free(pn);
+            return -ENOMEM;
+        }
+    }
+
+    pn->hist = alloc_percpu(struct pc_hist);
+    if (!pn->hist || pc_flows_alloc(pn))
+    {
+        pc_stats_free(pn);
+        return -ENOMEM;
+    }
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        if (pc_hook_is_ingress(&pn->hooks[h]))
+        {
+            pn->hooks[h].flows = flows ? pn->flows : NULL;
+            pn->hooks[h].hist = histograms ? pn->hist : NULL;
+        }
+    }
+    return 0;
+}
+
+// Le entry stanno in /proc/net/packet_counter: ognuno vede quelle del proprio namespace
+static int pc_proc_init(struct net *net)
+{
+    struct proc_dir_entry *dir;
+
+    dir = proc_mkdir("packet_counter", net->proc_net);
+    if (!dir)
+    {
+        return -ENOMEM;
+    }
+
+    if (!proc_create_net_single("tcp_packets", 0444, dir, tcp_show, NULL) ||
+        !proc_create_net_single("udp_packets", 0444, dir, udp_show, NULL) ||
+        !proc_create_net_single("port_packets", 0444, dir, port_show, NULL) ||
+        !proc_create_net_single("hooks", 0444, dir, hooks_show, NULL) ||
+        !proc_create_net_single("top_flows", 0444, dir, top_flows_show, NULL) ||
+        !proc_create_net_single("histograms", 0444, dir, histograms_show, NULL) ||
+        !proc_create_data("counters", 0444, dir, &counters_proc_ops, net))
+    {
+        remove_proc_subtree("packet_counter", net->proc_net);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+// Parametri del modulo, in /sys/module/packet_counter/parameters: ogni
+// scrittura pubblica una nuova pc_config, senza ricaricare il modulo
+struct pc_param {
+    int (*parse)(struct pc_config *cfg, const char *val);
+    int (*show)(const struct pc_config *cfg, char *buf);
+};
+
+static const char *const pc_proto_names[] = { "tcp", "udp", "other" };
+
+static int pc_parse_priority(struct pc_config *cfg, const char *val)
+{
+    return kstrtoint(val, 0, &cfg->priority);
+}
+
+static int pc_show_priority(const struct pc_config *cfg, char *buf)
+{
+    return sysfs_emit(buf, "%d\n", cfg->priority);
+}
+
+// Lista separata da virgole, per esempio "tcp,udp"
+static int pc_parse_protocols(struct pc_config *cfg, const char *val)
+{
+    char *list, *cur, *name;
+    unsigned int protos = 0;
+    int i, err = 0;
+
+    list = kstrdup(val, GFP_KERNEL);
+    if (!list)
+    {
+        return -ENOMEM;
+    }
+
+    cur = strim(list);
+    while ((name = strsep(&cur, ",")) && !err)
+    {
+        if (!*name)
+        {
+            continue;
+        }
+        i = match_string(pc_proto_names, ARRAY_SIZE(pc_proto_names), name);
+        if (i < 0)
+        {
+            err = -EINVAL;
+        }
+        else
+        {
+            protos |= BIT(i);
+        }
+    }
+    kfree(list);
+
+    if (!err)
+    {
+        cfg->protos = protos;
+    }
+    return err;
+}
+
+static int pc_show_protocols(const struct pc_config *cfg, char *buf)
+{
+    int i, len = 0;
+
+    for (i = 0; i < ARRAY_SIZE(pc_proto_names); i++)
+    {
+        if (cfg->protos & BIT(i))
+        {
+            len += sysfs_emit_at(buf, len, "%s%s", len ? "," : "", pc_proto_names[i]);
+        }
+    }
+    return len + sysfs_emit_at(buf, len, "\n");
+}
+
+// "MIN-MAX", oppure una porta sola
+static int pc_parse_ports(struct pc_config *cfg, const char *val)
+{
+    u16 min, max;
+
+    if (sscanf(val, "%hu-%hu", &min, &max) != 2)
+    {
+        if (kstrtou16(val, 0, &min))
+        {
+            return -EINVAL;
+        }
+        max = min;
+    }
+    if (min > max)
+    {
+        return -EINVAL;
+    }
+
+    cfg->port_min = min;
+    cfg->port_max = max;
+    return 0;
+}
+
+static int pc_show_ports(const struct pc_config *cfg, char *buf)
+{
+    return sysfs_emit(buf, "%u-%u\n", cfg->port_min, cfg->port_max);
+}
+
+static int pc_parse_sample_rate(struct pc_config *cfg, const char *val)
+{
+    unsigned int rate;
+    int err;
+
+    err = kstrtouint(val, 0, &rate);
+    if (err || !rate)
+    {
+        return -EINVAL;
+    }
+    cfg->sample_rate = rate;
+    return 0;
+}
+
+static int pc_show_sample_rate(const struct pc_config *cfg, char *buf)
+{
+    return sysfs_emit(buf, "%u\n", cfg->sample_rate);
+}
+
+static int pc_parse_milestone(struct pc_config *cfg, const char *val)
+{
+    return kstrtouint(val, 0, &cfg->milestone);
+}
+
+static int pc_show_milestone(const struct pc_config *cfg, char *buf)
+{
+    return sysfs_emit(buf, "%u\n", cfg->milestone);
+}
+
+// Chiamata anche per i parametri di insmod, prima di packet_counter_init
+static int pc_param_set(const char *val, const struct kernel_param *kp)
+{
+    const struct pc_param *param = kp->arg;
+    struct pc_config *cfg;
+
+    cfg = pc_config_begin();
+    if (!cfg)
+    {
+        return -ENOMEM;
+    }
+    return pc_config_commit(cfg, param->parse(cfg, val));
+}
+
+static int pc_param_get(char *buf, const struct kernel_param *kp)
+{
+    const struct pc_param *param = kp->arg;
+    int len;
+
+    rcu_read_lock();
+    len = param->show(rcu_dereference(pc_config), buf);
+    rcu_read_unlock();
+    return len;
+}
+
+static const struct kernel_param_ops pc_param_ops = {
+    .set = pc_param_set,
+    .get = pc_param_get,
+};
+
+#define PC_PARAM(_name, _desc)                                                  \
+    static struct pc_param pc_param_##_name = {                                 \
+        .parse = pc_parse_##_name,                                              \
+        .show  = pc_show_##_name,                                               \
+    };                                                                          \
+    module_param_cb(_name, &pc_param_ops, &pc_param_##_name, 0644);             \
+    MODULE_PARM_DESC(_name, _desc)
+
+PC_PARAM(priority, "Netfilter hook priority (default NF_IP_PRI_FIRST)");
+PC_PARAM(protocols, "Protocols to count: tcp,udp,other (default all)");
+PC_PARAM(ports, "Destination ports counted one by one, MIN-MAX (default 0-65535)");
+PC_PARAM(sample_rate, "Count one packet every N, per CPU and hook (default 1)");
+PC_PARAM(milestone, "Notify every N packets seen by a CPU (0 = off), rate limited");
+
+static void pc_net_remove(struct pc_net *pn)
+{
+    mutex_lock(&pc_config_lock);
+    list_del(&pn->list);
+    pc_net_unregister(pn);
+    mutex_unlock(&pc_config_lock);
+}
+
+static int __net_init pc_net_init(struct net *net)
+{
+    struct pc_net *pn = pc_pernet(net);
+    int err, i;
+
+    err = pc_stats_alloc(pn);
+    if (err)
+    {
+        return err;
+    }
+
+    // Configura un hook netfilter per ogni famiglia e punto di aggancio,
+    // ognuno riceve i propri contatori tramite priv
+    pn->net = net;
+    for (i = 0; i < PC_NR_HOOKS; i++)
+    {
+        pn->ops[i].hook = packet_counter_hook;
+        pn->ops[i].priv = &pn->hooks[i];
+        pn->ops[i].pf = pc_hook_descs[i].pf;
+        pn->ops[i].hooknum = pc_hook_descs[i].hooknum;
+    }
+
+    // Sotto il lock, così un cambio di priorità non salta questo namespace
+    mutex_lock(&pc_config_lock);
+    err = pc_net_register(pn, rcu_dereference_protected(pc_config, lockdep_is_held(&pc_config_lock))->priority);
+    if (!err)
+    {
+        list_add(&pn->list, &pc_nets);
+    }
+    mutex_unlock(&pc_config_lock);
+    if (err)
+    {
+        pc_stats_free(pn);
+        return err;
+    }
+
+    err = pc_proc_init(net);
+    if (err)
+    {
+        pc_net_remove(pn);
+        pc_stats_free(pn);
+        return err;
+    }
+    return 0;
+}
+
+static void __net_exit pc_net_exit(struct net *net)
+{
+    struct pc_net *pn = pc_pernet(net);
+    struct pc_stats __percpu *stats[PC_NR_HOOKS];
+    unsigned long *active_ports[PC_NR_HOOKS];
+    int h;
+
+    remove_proc_subtree("packet_counter", net->proc_net);
+
+    // Dopo l'unregister nessun hook sta più usando i contatori
+    pc_net_remove(pn);
+
+    // I kfunc invece possono ancora leggerli, sotto RCU, da un tp_btf o da un
+    // iteratore: prima si staccano i puntatori, poi si aspetta che chi li ha
+    // già letti esca dalla sezione RCU, infine si libera
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        stats[h] = pn->hooks[h].stats;
+        active_ports[h] = pn->hooks[h].active_ports;
+        WRITE_ONCE(pn->hooks[h].stats, NULL);
+        WRITE_ONCE(pn->hooks[h].active_ports, NULL);
+    }
+    synchronize_rcu();
+    for (h = 0; h < PC_NR_HOOKS; h++)
+    {
+        pc_hook_stats_free(stats[h]);
+        bitmap_free(active_ports[h]);
+    }
+
+    pc_stats_free(pn);
+}
+
+static struct pernet_operations pc_net_ops = {
+    .init = pc_net_init,
+    .exit = pc_net_exit,
+    .id   = &pc_net_id,
+    .size = sizeof(struct pc_net),
+};
+
+static int __init packet_counter_init(void)
+{
+    int err;
+
+    get_random_bytes(&pc_flow_secret, sizeof(pc_flow_secret));
+
+    // Chiama pc_net_init per ogni namespace esistente e per quelli creati in seguito
+    err = register_pernet_subsys(&pc_net_ops);
+    if (err)
+    {
+        return err;
+    }
+
+    err = genl_register_family(&pc_genl_family);
+    if (err)
+    {
+        unregister_pernet_subsys(&pc_net_ops);
+        return err;
+    }
+
+    // I kfunc restano registrati finché il modulo è caricato, e un programma
+    // che li usa tiene il modulo caricato
+    err = register_btf_kfunc_id_set(BPF_PROG_TYPE_TRACING, &pc_kfunc_set);
+    if (err)
+    {
+        genl_unregister_family(&pc_genl_family);
+        unregister_pernet_subsys(&pc_net_ops);
+        return err;
+    }
+
+    printk(KERN_INFO "packet_counter: modulo caricato\n");
+    return 0;
+}
+
+static void __exit packet_counter_exit(void)
+{
+    struct pc_config *cfg;
+
+    genl_unregister_family(&pc_genl_family);
+    unregister_pernet_subsys(&pc_net_ops);
+
+    // Nessun hook è più registrato, quindi nessuno sta leggendo la configurazione
+    cfg = rcu_dereference_protected(pc_config, true);
+    if (cfg != &pc_config_default)
+    {
+        kfree(cfg);
+    }
+
+    printk(KERN_INFO "packet_counter: modulo rimosso\n");
+}
+
+module_init(packet_counter_init);
+module_exit(packet_counter_exit);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _PACKET_COUNTER_EXPORT_H
+#define _PACKET_COUNTER_EXPORT_H
+
+#include <linux/types.h>
+
+/* Layout binario di /proc/net/packet_counter/counters, condiviso con lo
+ * spazio utente. Ogni open() congela un'istantanea dei contatori del
+ * namespace, già sommati su tutte le CPU; il file si legge con read() o con
+ * un solo mmap() a partire dall'offset 0:
+ *
+ *   struct pc_export_header
+ *   struct pc_export_hook   hooks[nr_hooks]   a partire da hooks_off
+ *   struct pc_export_port   ports[nr_ports]   a partire da ports_off
+ *
+ * I campi aggiunti in futuro andranno in coda alle strutture, aumentando
+ * version e le dimensioni indicate nell'header: un lettore usa hook_size e
+ * port_size come passo e ignora i byte che non conosce.
+ */
+#define PC_EXPORT_MAGIC		0x50434e54	/* "PCNT" */
+#define PC_EXPORT_VERSION	1
+
+struct pc_export_header {
+	__u32 magic;
+	__u16 version;
+	__u16 header_size;	/* sizeof(struct pc_export_header) */
+	__u64 timestamp_ns;	/* CLOCK_REALTIME dell'istantanea */
+	__u32 size;		/* byte validi, header compreso */
+	__u32 nr_hooks;
+	__u32 hooks_off;
+	__u32 hook_size;
+	__u32 nr_ports;
+	__u32 ports_off;
+	__u32 port_size;
+	__u32 pad;
+};
+
+/* Contatori di un hook netfilter (NFPROTO_*, NF_INET_*) */
+struct pc_export_hook {
+	__u8 pf;
+	__u8 hooknum;
+	__u8 pad[6];
+	__u64 tcp;
+	__u64 udp;
+	__u64 total;
+	__u64 port_lost;
+};
+
+/* Porte di destinazione viste in ingresso (hook di PRE_ROUTING), in ordine
+ * crescente e solo quelle con almeno un pacchetto
+ */
+struct pc_export_port {
+	__u16 port;
+	__u8 pad[6];
+	__u64 packets;
+};
+
+#endif /* _PACKET_COUNTER_EXPORT_H */
@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _PACKET_COUNTER_FLOWS_H
+#define _PACKET_COUNTER_FLOWS_H
+
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/seqlock.h>
+#include <linux/siphash.h>
+#include <linux/string.h>
+#include <net/ipv6.h>
+
+#include "packet_counter_parse.h"
+
+// Flussi più pesanti in ingresso, con memoria fissa e costo costante per pacchetto.
+//
+// Ogni CPU tiene un Count-Min Sketch di PC_CMS_DEPTH righe da PC_CMS_WIDTH
+// contatori, indicizzate dall'hash della 5-tupla, e una classifica di
+// PC_TOPK flussi: quando la stima di un flusso supera il minimo della
+// classifica, il flusso prende il posto di quello più leggero (come in
+// Space-Saving). In lettura le classifiche delle CPU danno i candidati, e la
+// stima di ognuno si prende dalla somma degli sketch di tutte le CPU.
+//
+// La stima non è mai inferiore al valore vero e lo supera al più di
+// e / PC_CMS_WIDTH (circa 0,27%) dei pacchetti contati, con probabilità
+// 1 - e^-PC_CMS_DEPTH (circa 98%). L'hash ha una chiave casuale, quindi chi
+// genera il traffico non può scegliere flussi che collidono apposta.
+
+#define PC_CMS_DEPTH 4
+#define PC_CMS_WIDTH 1024   // potenza di 2
+#define PC_TOPK 16
+
+// IPv4 è salvato come indirizzo mappato ::ffff:a.b.c.d; le porte sono 0
+// per i protocolli senza porte e per i frammenti successivi al primo
+struct pc_flow_key {
+    struct in6_addr saddr;
+    struct in6_addr daddr;
+    __be16 sport;
+    __be16 dport;
+    u8 proto;
+    u8 pf;
+    u8 pad[2];
+} __aligned(SIPHASH_ALIGNMENT);
+
+struct pc_flow_entry {
+    struct pc_flow_key key;
+    u64 hash;               // confrontato prima della chiave
+    unsigned long count;    // stima dello sketch quando il flusso è stato visto l'ultima volta
+};
+
+// Stato di una CPU
+struct pc_flows {
+    unsigned long (*cms)[PC_CMS_WIDTH];     // PC_CMS_DEPTH righe, sul nodo della CPU
+    seqcount_t seq;                         // le altre CPU copiano top[] senza vederlo a metà
+    unsigned int top_len;
+    unsigned long top_min;                  // conteggio più basso in top[] quando è piena
+    struct pc_flow_entry top[PC_TOPK];
+};
+
+// Chiave dell'hash, estratta a caso al caricamento del modulo
+extern siphash_key_t pc_flow_secret;
+
+// Indirizzi e porte del pacchetto; thoff e proto sono quelli di pc_transport
+static inline bool pc_flow_key_build(const struct sk_buff *skb, u8 pf, int thoff, u8 proto,
+                                     struct pc_flow_key *key)
+{
+    int offset = skb_network_offset(skb);
+
+    memset(key, 0, sizeof(*key));
+    key->pf = pf;
+    key->proto = proto;
+
+    if (pf == NFPROTO_IPV4)
+    {
+        const struct iphdr *iph;
+        struct iphdr _iph;
+
+        iph = skb_header_pointer(skb, offset, sizeof(_iph), &_iph);
+        if (!iph)
+        {
+            return false;
+        }
+        ipv6_addr_set_v4mapped(iph->saddr, &key->saddr);
+        ipv6_addr_set_v4mapped(iph->daddr, &key->daddr);
+    }
+    else
+    {
+        const struct ipv6hdr *ip6h;
+        struct ipv6hdr _ip6h;
+
+        ip6h = skb_header_pointer(skb, offset, sizeof(_ip6h), &_ip6h);
+        if (!ip6h)
+        {
+            return false;
+        }
+        key->saddr = ip6h->saddr;
+        key->daddr = ip6h->daddr;
+    }
+
+    if (thoff >= 0 && (proto == IPPROTO_TCP || proto == IPPROTO_UDP))
+    {
+        const __be16 *ports;
+        __be16 _ports[2];
+
+        ports = skb_header_pointer(skb, thoff, sizeof(_ports), _ports);
+        if (ports)
+        {
+            key->sport = ports[0];
+            key->dport = ports[1];
+        }
+    }
+    return true;
+}
+
+// Riga r dello sketch: due metà di un solo hash a 64 bit (Kirsch-Mitzenmacher)
+static inline unsigned int pc_flow_slot(u64 hash, int r)
+{
+    return ((u32)hash + r * ((u32)(hash >> 32) | 1)) & (PC_CMS_WIDTH - 1);
+}
+
+static inline void pc_flow_top_min(struct pc_flows *fl)
+{
+    unsigned long low = ULONG_MAX;
+    unsigned int i;
+
+    for (i = 0; i < fl->top_len; i++)
+    {
+        low = min(low, fl->top[i].count);
+    }
+    fl->top_min = fl->top_len == PC_TOPK ? low : 0;
+}
+
+// Fuori dal percorso veloce: il flusso entra in classifica al posto di
+// quello più leggero, o in un posto libero
+static noinline void pc_flow_top_insert(struct pc_flows *fl, const struct pc_flow_key *key,
+                                        u64 hash, unsigned long count)
+{
+    unsigned int i, slot;
+
+    if (fl->top_len < PC_TOPK)
+    {
+        slot = fl->top_len;
+    }
+    else
+    {
+        for (i = 1, slot = 0; i < PC_TOPK; i++)
+        {
+            if (fl->top[i].count < fl->top[slot].count)
+            {
+                slot = i;
+            }
+        }
+    }
+
+    write_seqcount_begin(&fl->seq);
+    fl->top[slot].key = *key;
+    fl->top[slot].hash = hash;
+    fl->top[slot].count = count;
+    if (slot == fl->top_len)
+    {
+        fl->top_len++;
+    }
+    write_seqcount_end(&fl->seq);
+
+    pc_flow_top_min(fl);
+}
+
+// Percorso veloce, con i softirq disabilitati: un hash e PC_CMS_DEPTH
+// incrementi. La classifica si guarda solo se il flusso può starci, e per
+// un flusso già presente basta aggiornarne la stima
+static inline void pc_flow_count(struct pc_flows *fl, const struct pc_flow_key *key)
+{
+    unsigned long est = ULONG_MAX, old;
+    unsigned int i;
+    u64 hash;
+    int r;
+
+    hash = siphash(key, sizeof(*key), &pc_flow_secret);
+    for (r = 0; r < PC_CMS_DEPTH; r++)
+    {
+        unsigned long c = ++fl->cms[r][pc_flow_slot(hash, r)];
+
+        est = min(est, c);
+    }
+
+    if (likely(est <= fl->top_min))
+    {
+        return;
+    }
+
+    for (i = 0; i < fl->top_len; i++)
+    {
+        if (fl->top[i].hash == hash && !memcmp(&fl->top[i].key, key, sizeof(*key)))
+        {
+            old = fl->top[i].count;
+            WRITE_ONCE(fl->top[i].count, est);
+            if (old == fl->top_min)
+            {
+                pc_flow_top_min(fl);
+            }
+            return;
+        }
+    }
+    pc_flow_top_insert(fl, key, hash, est);
+}
+
+#endif /* _PACKET_COUNTER_FLOWS_H */
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _PACKET_COUNTER_GENL_H
+#define _PACKET_COUNTER_GENL_H
+
+/* Famiglia generic netlink di packet_counter, condivisa con pcctl.
+ *
+ * PC_CMD_DUMP (dump) restituisce un'istantanea coerente dei contatori del
+ * namespace, presa all'inizio del dump: un messaggio PC_ATTR_HOOK per ogni
+ * hook, poi un messaggio PC_ATTR_PORT per ogni porta di ingresso con almeno
+ * un pacchetto, eventualmente filtrate con PC_ATTR_PORT_MIN/MAX. I messaggi
+ * sono impacchettati in più risposte NLM_F_MULTI, chiuse da NLMSG_DONE.
+ *
+ * PC_CMD_RESET azzera i contatori del namespace (CAP_NET_ADMIN).
+ * PC_CMD_GET_CONFIG / PC_CMD_SET_CONFIG leggono e cambiano i parametri del
+ * modulo, gli stessi di /sys/module/packet_counter/parameters; SET richiede
+ * CAP_NET_ADMIN nel namespace iniziale. In SET_CONFIG gli attributi assenti
+ * restano invariati e PC_ATTR_PORT_MIN/MAX sono l'intervallo delle porte
+ * contate una per una.
+ */
+#define PC_GENL_NAME		"packet_counter"
+#define PC_GENL_VERSION		1
+
+enum {
+	PC_CMD_UNSPEC,
+	PC_CMD_DUMP,
+	PC_CMD_RESET,
+	PC_CMD_GET_CONFIG,
+	PC_CMD_SET_CONFIG,
+	__PC_CMD_MAX,
+};
+#define PC_CMD_MAX (__PC_CMD_MAX - 1)
+
+enum {
+	PC_ATTR_UNSPEC,
+	PC_ATTR_PAD,
+	PC_ATTR_HOOK,		/* nest, PC_HOOK_ATTR_* */
+	PC_ATTR_PORT,		/* nest, PC_PORT_ATTR_* */
+	PC_ATTR_PORT_MIN,	/* u16, filtro di PC_CMD_DUMP */
+	PC_ATTR_PORT_MAX,	/* u16, filtro di PC_CMD_DUMP */
+	PC_ATTR_MILESTONE,	/* u32, vedi il parametro milestone */
+	PC_ATTR_TIMESTAMP,	/* u64, CLOCK_REALTIME dell'istantanea */
+	PC_ATTR_PRIORITY,	/* s32, priorità dei netfilter hook */
+	PC_ATTR_PROTOCOLS,	/* u32, PC_PROTO_* */
+	PC_ATTR_SAMPLE_RATE,	/* u32, almeno 1 */
+	__PC_ATTR_MAX,
+};
+#define PC_ATTR_MAX (__PC_ATTR_MAX - 1)
+
+/* Protocolli contati, PC_ATTR_PROTOCOLS e il parametro protocols */
+#define PC_PROTO_TCP		(1U << 0)
+#define PC_PROTO_UDP		(1U << 1)
+#define PC_PROTO_OTHER		(1U << 2)
+#define PC_PROTO_ALL		(PC_PROTO_TCP | PC_PROTO_UDP | PC_PROTO_OTHER)
+
+enum {
+	PC_HOOK_ATTR_UNSPEC,
+	PC_HOOK_ATTR_PAD,
+	PC_HOOK_ATTR_PF,	/* u8, NFPROTO_* */
+	PC_HOOK_ATTR_HOOKNUM,	/* u8, NF_INET_* */
+	PC_HOOK_ATTR_TCP,	/* u64 */
+	PC_HOOK_ATTR_UDP,	/* u64 */
+	PC_HOOK_ATTR_TOTAL,	/* u64 */
+	PC_HOOK_ATTR_PORT_LOST,	/* u64 */
+	__PC_HOOK_ATTR_MAX,
+};
+#define PC_HOOK_ATTR_MAX (__PC_HOOK_ATTR_MAX - 1)
+
+enum {
+	PC_PORT_ATTR_UNSPEC,
+	PC_PORT_ATTR_PAD,
+	PC_PORT_ATTR_PORT,	/* u16 */
+	PC_PORT_ATTR_PACKETS,	/* u64 */
+	__PC_PORT_ATTR_MAX,
+};
+#define PC_PORT_ATTR_MAX (__PC_PORT_ATTR_MAX - 1)
+
+#endif /* _PACKET_COUNTER_GENL_H */
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _PACKET_COUNTER_PARSE_H
+#define _PACKET_COUNTER_PARSE_H
+
+#include <linux/netfilter.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/skbuff.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+
+// Accesso agli header condiviso dal modulo e dal suo microbenchmark.
+// Ogni lettura passa da skb_header_pointer: se i byte sono nell'area lineare
+// restituisce direttamente il puntatore (nessuna copia), altrimenti li copia
+// dai frammenti nel buffer sullo stack. Nessun skb viene mai linearizzato.
+
+// Protocollo L4 e offset del suo header; per IPv6 salta gli extension header.
+// Restituisce -1 per gli header troncati o malformati (*proto resta 0) e per
+// i frammenti successivi al primo, che non hanno porte
+static inline int pc_transport(const struct sk_buff *skb, u8 pf, u8 *proto)
+{
+    int offset = skb_network_offset(skb);
+    __be16 frag_off;
+
+    *proto = 0;
+
+    if (pf == NFPROTO_IPV4)
+    {
+        const struct iphdr *iph;
+        struct iphdr _iph;
+
+        iph = skb_header_pointer(skb, offset, sizeof(_iph), &_iph);
+        if (!iph || iph->ihl < 5)
+        {
+            return -1;
+        }
+
+        *proto = iph->protocol;
+        if (iph->frag_off & htons(IP_OFFSET))
+        {
+            return -1;
+        }
+        return offset + iph->ihl * 4;
+    }
+    else
+    {
+        const struct ipv6hdr *ip6h;
+        struct ipv6hdr _ip6h;
+        u8 nexthdr;
+
+        ip6h = skb_header_pointer(skb, offset, sizeof(_ip6h), &_ip6h);
+        if (!ip6h)
+        {
+            return -1;
+        }
+
+        nexthdr = ip6h->nexthdr;
+        offset = ipv6_skip_exthdr(skb, offset + sizeof(_ip6h), &nexthdr, &frag_off);
+        if (offset < 0)
+        {
+            return -1;
+        }
+
+        *proto = nexthdr;
+        if (frag_off & htons(IP6_OFFSET))
+        {
+            return -1;
+        }
+        return offset;
+    }
+}
+
+// Porta di destinazione: nella stessa posizione per TCP e UDP; 0 se l'header è troncato
+static inline int pc_dest_port(const struct sk_buff *skb, int thoff)
+{
+    const __be16 *ports;
+    __be16 _ports[2];
+
+    ports = skb_header_pointer(skb, thoff, sizeof(_ports), _ports);
+    return ports ? ntohs(ports[1]) : 0;
+}
+
+#endif /* _PACKET_COUNTER_PARSE_H */
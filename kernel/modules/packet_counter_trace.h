@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM packet_counter
+
+#if !defined(_PACKET_COUNTER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PACKET_COUNTER_TRACE_H
+
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/tracepoint.h>
+
+/* Per-packet events, they cost a static branch when disabled:
+ *
+ *   echo 1 > /sys/kernel/tracing/events/packet_counter/enable
+ */
+DECLARE_EVENT_CLASS(packet_counter_packet,
+
+	TP_PROTO(const struct sk_buff *skb, u16 dest_port),
+
+	TP_ARGS(skb, dest_port),
+
+	TP_STRUCT__entry(
+		__field(int,	ifindex)
+		__field(u32,	len)
+		__field(u16,	dest_port)
+	),
+
+	TP_fast_assign(
+		__entry->ifindex = skb->dev ? skb->dev->ifindex : 0;
+		__entry->len = skb->len;
+		__entry->dest_port = dest_port;
+	),
+
+	TP_printk("ifindex=%d len=%u dest_port=%u",
+		  __entry->ifindex, __entry->len, __entry->dest_port)
+);
+
+DEFINE_EVENT(packet_counter_packet, packet_counter_tcp,
+	TP_PROTO(const struct sk_buff *skb, u16 dest_port),
+	TP_ARGS(skb, dest_port)
+);
+
+DEFINE_EVENT(packet_counter_packet, packet_counter_udp,
+	TP_PROTO(const struct sk_buff *skb, u16 dest_port),
+	TP_ARGS(skb, dest_port)
+);
+
+TRACE_EVENT(packet_counter_milestone,
+
+	TP_PROTO(u64 total),
+
+	TP_ARGS(total),
+
+	TP_STRUCT__entry(
+		__field(u64,	total)
+	),
+
+	TP_fast_assign(
+		__entry->total = total;
+	),
+
+	TP_printk("total=%llu", __entry->total)
+);
+
+#endif /* _PACKET_COUNTER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE packet_counter_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,445 @@
+// Client della famiglia generic netlink di packet_counter.
+//
+//   pcctl dump [PORT_MIN[-PORT_MAX]]   contatori per hook e per porta
+//   pcctl reset                        azzera i contatori del namespace
+//   pcctl get                          parametri del modulo
+//   pcctl set NOME VALORE              cambia un parametro: priority N,
+//                                      protocols tcp,udp,other, ports MIN-MAX,
+//                                      sample_rate N, milestone N
+//
+// Usa solo socket netlink, senza libnl: un dump è una richiesta e qualche
+// recv, al posto di più open e del parsing del testo di /proc.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/genetlink.h>
+#include <linux/netfilter.h>
+#include <linux/netlink.h>
+
+#include "packet_counter_genl.h"
+
+#define PCCTL_BUF_SIZE 65536
+
+struct pcctl_req {
+    struct nlmsghdr nlh;
+    struct genlmsghdr genl;
+    char attrs[256];
+};
+
+static const char *hook_names[] = {
+    [NF_INET_PRE_ROUTING] = "prerouting",
+    [NF_INET_LOCAL_IN]    = "input",
+    [NF_INET_FORWARD]     = "forward",
+    [NF_INET_LOCAL_OUT]   = "output",
+    [NF_INET_POST_ROUTING] = "postrouting",
+};
+
+static void req_init(struct pcctl_req *req, uint16_t type, uint8_t cmd, uint16_t flags)
+{
+    memset(req, 0, sizeof(*req));
+    req->nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    req->nlh.nlmsg_type = type;
+    req->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+    req->genl.cmd = cmd;
+    req->genl.version = PC_GENL_VERSION;
+}
+
+static void req_put(struct pcctl_req *req, uint16_t type, const void *data, uint16_t len)
+{
+    struct nlattr *nla = (struct nlattr *)((char *)&req->nlh + NLMSG_ALIGN(req->nlh.nlmsg_len));
+
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy((char *)nla + NLA_HDRLEN, data, len);
+    req->nlh.nlmsg_len = NLMSG_ALIGN(req->nlh.nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+// Divide gli attributi di [data, data + len) per tipo; gli sconosciuti sono ignorati
+static void parse_attrs(struct nlattr **tb, int max, void *data, int len)
+{
+    struct nlattr *nla;
+
+    memset(tb, 0, sizeof(*tb) * (max + 1));
+    for (nla = data; len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len;
+         len -= NLA_ALIGN(nla->nla_len), nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len)))
+    {
+        int type = nla->nla_type & NLA_TYPE_MASK;
+
+        if (type <= max)
+        {
+            tb[type] = nla;
+        }
+    }
+}
+
+static void *nla_data(struct nlattr *nla)
+{
+    return (char *)nla + NLA_HDRLEN;
+}
+
+static uint64_t nla_u64(struct nlattr *nla)
+{
+    uint64_t v = 0;
+
+    if (nla)
+    {
+        memcpy(&v, nla_data(nla), sizeof(v));
+    }
+    return v;
+}
+
+static int nl_send(int fd, struct pcctl_req *req)
+{
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+    if (sendto(fd, req, req->nlh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        return -errno;
+    }
+    return 0;
+}
+
+// Riceve fino alla fine della risposta e passa ogni messaggio a cb;
+// restituisce l'errore riportato dal kernel, se c'è
+static int nl_recv(int fd, int (*cb)(struct nlmsghdr *nlh, void *arg), void *arg)
+{
+    static char buf[PCCTL_BUF_SIZE];
+    struct nlmsghdr *nlh;
+    int len, err;
+
+    for (;;)
+    {
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0)
+        {
+            return -errno;
+        }
+
+        for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            if (nlh->nlmsg_type == NLMSG_DONE)
+            {
+                return 0;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                // Con error = 0 è l'ack di una richiesta senza risposta
+                return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+            }
+            if (cb)
+            {
+                err = cb(nlh, arg);
+                if (err)
+                {
+                    return err;
+                }
+            }
+            if (!(nlh->nlmsg_flags & NLM_F_MULTI))
+            {
+                return 0;
+            }
+        }
+    }
+}
+
+static int family_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct nlattr *tb[CTRL_ATTR_MAX + 1];
+
+    parse_attrs(tb, CTRL_ATTR_MAX, (char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+                nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+    if (tb[CTRL_ATTR_FAMILY_ID])
+    {
+        memcpy(arg, nla_data(tb[CTRL_ATTR_FAMILY_ID]), sizeof(uint16_t));
+    }
+    return 0;
+}
+
+static int family_resolve(int fd, uint16_t *id)
+{
+    struct pcctl_req req;
+    int err;
+
+    req_init(&req, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0);
+    req.genl.version = 1;
+    req_put(&req, CTRL_ATTR_FAMILY_NAME, PC_GENL_NAME, sizeof(PC_GENL_NAME));
+
+    *id = 0;
+    err = nl_send(fd, &req);
+    if (!err)
+    {
+        err = nl_recv(fd, family_cb, id);
+    }
+    if (!err && !*id)
+    {
+        err = -ENOENT;
+    }
+    return err;
+}
+
+static int dump_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct nlattr *tb[PC_ATTR_MAX + 1];
+    struct nlattr *hook[PC_HOOK_ATTR_MAX + 1];
+    struct nlattr *port[PC_PORT_ATTR_MAX + 1];
+
+    parse_attrs(tb, PC_ATTR_MAX, (char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+                nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+
+    if (tb[PC_ATTR_HOOK])
+    {
+        uint8_t pf, hooknum;
+
+        parse_attrs(hook, PC_HOOK_ATTR_MAX, nla_data(tb[PC_ATTR_HOOK]),
+                    tb[PC_ATTR_HOOK]->nla_len - NLA_HDRLEN);
+        if (!hook[PC_HOOK_ATTR_PF] || !hook[PC_HOOK_ATTR_HOOKNUM])
+        {
+            return 0;
+        }
+        pf = *(uint8_t *)nla_data(hook[PC_HOOK_ATTR_PF]);
+        hooknum = *(uint8_t *)nla_data(hook[PC_HOOK_ATTR_HOOKNUM]);
+
+        printf("%s %-12s tcp %12llu udp %12llu totale %12llu\n",
+               pf == NFPROTO_IPV6 ? "ipv6" : "ipv4",
+               hooknum <= NF_INET_POST_ROUTING ? hook_names[hooknum] : "?",
+               (unsigned long long)nla_u64(hook[PC_HOOK_ATTR_TCP]),
+               (unsigned long long)nla_u64(hook[PC_HOOK_ATTR_UDP]),
+               (unsigned long long)nla_u64(hook[PC_HOOK_ATTR_TOTAL]));
+    }
+    else if (tb[PC_ATTR_PORT])
+    {
+        parse_attrs(port, PC_PORT_ATTR_MAX, nla_data(tb[PC_ATTR_PORT]),
+                    tb[PC_ATTR_PORT]->nla_len - NLA_HDRLEN);
+        if (!port[PC_PORT_ATTR_PORT])
+        {
+            return 0;
+        }
+        printf("porta %5u %12llu pacchetti\n", *(uint16_t *)nla_data(port[PC_PORT_ATTR_PORT]),
+               (unsigned long long)nla_u64(port[PC_PORT_ATTR_PACKETS]));
+    }
+    return 0;
+}
+
+static const char *proto_names[] = { "tcp", "udp", "other" };
+
+static int config_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct nlattr *tb[PC_ATTR_MAX + 1];
+
+    parse_attrs(tb, PC_ATTR_MAX, (char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+                nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+    if (tb[PC_ATTR_PRIORITY])
+    {
+        printf("priority %d\n", *(int32_t *)nla_data(tb[PC_ATTR_PRIORITY]));
+    }
+    if (tb[PC_ATTR_PROTOCOLS])
+    {
+        uint32_t protos = *(uint32_t *)nla_data(tb[PC_ATTR_PROTOCOLS]);
+        const char *sep = "";
+        int i;
+
+        printf("protocols ");
+        for (i = 0; i < 3; i++)
+        {
+            if (protos & (1U << i))
+            {
+                printf("%s%s", sep, proto_names[i]);
+                sep = ",";
+            }
+        }
+        printf("\n");
+    }
+    if (tb[PC_ATTR_PORT_MIN] && tb[PC_ATTR_PORT_MAX])
+    {
+        printf("ports %u-%u\n", *(uint16_t *)nla_data(tb[PC_ATTR_PORT_MIN]),
+               *(uint16_t *)nla_data(tb[PC_ATTR_PORT_MAX]));
+    }
+    if (tb[PC_ATTR_SAMPLE_RATE])
+    {
+        printf("sample_rate %u\n", *(uint32_t *)nla_data(tb[PC_ATTR_SAMPLE_RATE]));
+    }
+    if (tb[PC_ATTR_MILESTONE])
+    {
+        printf("milestone %u\n", *(uint32_t *)nla_data(tb[PC_ATTR_MILESTONE]));
+    }
+    return 0;
+}
+
+// PORT_MIN[-PORT_MAX], con PORT_MIN <= PORT_MAX <= 65535 e nient'altro dopo
+static int parse_ports(const char *str, uint16_t *min, uint16_t *max)
+{
+    unsigned long lo, hi;
+    char *end;
+
+    lo = strtoul(str, &end, 0);
+    hi = lo;
+    if (end != str && *end == '-')
+    {
+        str = end + 1;
+        hi = strtoul(str, &end, 0);
+    }
+    if (end == str || *end || lo > hi || hi > 65535)
+    {
+        return -EINVAL;
+    }
+    *min = lo;
+    *max = hi;
+    return 0;
+}
+
+// Traduce "set NOME VALORE" negli attributi di PC_CMD_SET_CONFIG
+static int config_put(struct pcctl_req *req, const char *name, const char *value)
+{
+    char *end;
+
+    if (!strcmp(name, "priority"))
+    {
+        int32_t priority = strtol(value, &end, 0);
+
+        req_put(req, PC_ATTR_PRIORITY, &priority, sizeof(priority));
+    }
+    else if (!strcmp(name, "protocols"))
+    {
+        char list[64], *cur = list, *tok;
+        uint32_t protos = 0;
+        int i;
+
+        snprintf(list, sizeof(list), "%s", value);
+        while ((tok = strsep(&cur, ",")))
+        {
+            for (i = 0; i < 3 && strcmp(tok, proto_names[i]); i++)
+                ;
+            if (i == 3)
+            {
+                return -EINVAL;
+            }
+            protos |= 1U << i;
+        }
+        req_put(req, PC_ATTR_PROTOCOLS, &protos, sizeof(protos));
+        return 0;
+    }
+    else if (!strcmp(name, "ports"))
+    {
+        uint16_t min, max;
+
+        if (parse_ports(value, &min, &max))
+        {
+            return -EINVAL;
+        }
+        req_put(req, PC_ATTR_PORT_MIN, &min, sizeof(min));
+        req_put(req, PC_ATTR_PORT_MAX, &max, sizeof(max));
+        return 0;
+    }
+    else if (!strcmp(name, "sample_rate") || !strcmp(name, "milestone"))
+    {
+        uint32_t v = strtoul(value, &end, 0);
+
+        req_put(req, name[0] == 's' ? PC_ATTR_SAMPLE_RATE : PC_ATTR_MILESTONE, &v, sizeof(v));
+    }
+    else
+    {
+        return -EINVAL;
+    }
+    return *end ? -EINVAL : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Uso: %s dump [PORT_MIN[-PORT_MAX]]\n"
+            "     %s reset\n"
+            "     %s get\n"
+            "     %s set priority|protocols|ports|sample_rate|milestone VALORE\n",
+            prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    int (*cb)(struct nlmsghdr *nlh, void *arg) = NULL;
+    struct pcctl_req req;
+    uint16_t family;
+    int fd, err;
+
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (fd < 0)
+    {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    err = family_resolve(fd, &family);
+    if (err)
+    {
+        fprintf(stderr, "famiglia %s non trovata (modulo caricato?): %s\n", PC_GENL_NAME, strerror(-err));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    if (!strcmp(argv[1], "dump"))
+    {
+        req_init(&req, family, PC_CMD_DUMP, NLM_F_DUMP);
+        if (argc > 2)
+        {
+            uint16_t min, max;
+
+            if (parse_ports(argv[2], &min, &max))
+            {
+                fprintf(stderr, "dump: intervallo di porte non valido: %s\n", argv[2]);
+                close(fd);
+                return EXIT_FAILURE;
+            }
+            req_put(&req, PC_ATTR_PORT_MIN, &min, sizeof(min));
+            req_put(&req, PC_ATTR_PORT_MAX, &max, sizeof(max));
+        }
+        cb = dump_cb;
+    }
+    else if (!strcmp(argv[1], "reset"))
+    {
+        req_init(&req, family, PC_CMD_RESET, NLM_F_ACK);
+    }
+    else if (!strcmp(argv[1], "get"))
+    {
+        req_init(&req, family, PC_CMD_GET_CONFIG, 0);
+        cb = config_cb;
+    }
+    else if (!strcmp(argv[1], "set") && argc == 4)
+    {
+        req_init(&req, family, PC_CMD_SET_CONFIG, NLM_F_ACK);
+        if (config_put(&req, argv[2], argv[3]))
+        {
+            fprintf(stderr, "set: valore non valido per %s: %s\n", argv[2], argv[3]);
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        usage(argv[0]);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    err = nl_send(fd, &req);
+    if (!err)
+    {
+        err = nl_recv(fd, cb, NULL);
+    }
+    if (err)
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(-err));
+    }
+
+    close(fd);
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
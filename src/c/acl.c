@@ -0,0 +1,551 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Userspace side of the xdp_prog_acl rule engine.
+ *
+ * The rules are stored in the pinned acl_rules array, which is the only
+ * source of truth: every change rewrites one slot and then recompiles the
+ * match tables from the whole array. An LPM lookup only returns the longest
+ * matching prefix, so the bitmap stored for a prefix also carries the rules
+ * of every shorter prefix covering it; the same goes for the protocol/port
+ * wildcards of acl_ports. New entries are written before stale ones are
+ * removed, so the program never sees a table without the rules it needs.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+
+#define ARRAY_SIZE(x)		(sizeof(x) / sizeof((x)[0]))
+
+/* Largest LPM key, struct acl_v6_key */
+#define ACL_LPM_KEY_MAX		(sizeof(__u32) + 16)
+
+struct acl_maps {
+	int rules;
+	int stats;
+	int src_v4;
+	int dst_v4;
+	int src_v6;
+	int dst_v6;
+	int ports;
+};
+
+static const char *acl_action_names[] = {
+	[ACL_ACTION_NONE]	= "none",
+	[ACL_ACTION_PASS]	= "pass",
+	[ACL_ACTION_DROP]	= "drop",
+	[ACL_ACTION_REDIRECT]	= "redirect",
+	[ACL_ACTION_COUNT]	= "count",
+};
+
+static const struct {
+	const char *name;
+	__u8 proto;
+} acl_proto_names[] = {
+	{ "icmp",	1 },
+	{ "tcp",	6 },
+	{ "udp",	17 },
+	{ "icmpv6",	58 },
+};
+
+static void acl_maps_close(struct acl_maps *maps)
+{
+	int *fd = (int *)maps;
+	size_t i;
+
+	for (i = 0; i < sizeof(*maps) / sizeof(int); i++)
+		if (fd[i] >= 0)
+			close(fd[i]);
+}
+
+static int acl_maps_open(struct acl_maps *maps)
+{
+	static const char *names[] = {
+		"acl_rules", "acl_rule_stats", "acl_src_v4", "acl_dst_v4",
+		"acl_src_v6", "acl_dst_v6", "acl_ports",
+	};
+	int *fd = (int *)maps;
+	size_t i;
+	int err;
+
+	for (i = 0; i < sizeof(*maps) / sizeof(int); i++)
+		fd[i] = -1;
+
+	for (i = 0; i < sizeof(*maps) / sizeof(int); i++) {
+		fd[i] = open_pinned_map(names[i]);
+		if (fd[i] < 0) {
+			err = fd[i];
+			acl_maps_close(maps);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int acl_rules_read(const struct acl_maps *maps,
+			  struct acl_rule rules[ACL_MAX_RULES])
+{
+	__u32 slot;
+
+	for (slot = 0; slot < ACL_MAX_RULES; slot++)
+		if (bpf_map_lookup_elem(maps->rules, &slot, &rules[slot]))
+			return -errno;
+
+	return 0;
+}
+
+/* Does the prefix @addr/@len contain the address @key? */
+static bool prefix_contains(const __u8 *addr, __u8 len, const __u8 *key)
+{
+	__u8 mask;
+
+	if (memcmp(addr, key, len / 8))
+		return false;
+	if (!(len % 8))
+		return true;
+
+	mask = 0xff << (8 - len % 8);
+	return !((addr[len / 8] ^ key[len / 8]) & mask);
+}
+
+/* Clear the host bits of @addr/@len */
+void prefix_mask(__u8 *addr, __u8 len, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (len >= 8) {
+			len -= 8;
+			continue;
+		}
+		addr[i] &= len ? 0xff << (8 - len) : 0;
+		len = 0;
+	}
+}
+
+static bool rule_in_family(const struct acl_rule *rule, __u8 family)
+{
+	return rule->action != ACL_ACTION_NONE &&
+	       (!rule->family || rule->family == family);
+}
+
+/* Remove from @fd the keys that were not written by the last rebuild, i.e.
+ * those not in the @nr_keys keys of @keys.
+ */
+static int acl_table_prune(int fd, const void *keys, int nr_keys,
+			   size_t key_size)
+{
+	__u8 key[ACL_LPM_KEY_MAX], next[ACL_LPM_KEY_MAX];
+	__u8 stale[2 * ACL_MAX_RULES + 1][ACL_LPM_KEY_MAX];
+	int nr_stale = 0, i;
+	void *prev = NULL;
+
+	while (!bpf_map_get_next_key(fd, prev, next)) {
+		for (i = 0; i < nr_keys; i++)
+			if (!memcmp(next, (const __u8 *)keys + i * key_size,
+				    key_size))
+				break;
+		if (i == nr_keys && nr_stale < (int)ARRAY_SIZE(stale))
+			memcpy(stale[nr_stale++], next, key_size);
+
+		memcpy(key, next, key_size);
+		prev = key;
+	}
+
+	for (i = 0; i < nr_stale; i++)
+		if (bpf_map_delete_elem(fd, stale[i]) && errno != ENOENT)
+			return -errno;
+
+	return 0;
+}
+
+/* Rebuild one LPM table: the source (@dst false) or destination prefixes
+ * of the rules of @family. Rules without a prefix go under /0.
+ */
+static int acl_lpm_rebuild(int fd, const struct acl_rule *rules, __u8 family,
+			   bool dst)
+{
+	size_t alen = family == AF_INET ? 4 : 16;
+	size_t key_size = sizeof(__u32) + alen;
+	__u8 keys[ACL_MAX_RULES][ACL_LPM_KEY_MAX];
+	int nr_keys = 0, i, j;
+	__u32 len;
+
+	for (i = 0; i < ACL_MAX_RULES; i++) {
+		const __u8 *addr = dst ? rules[i].daddr : rules[i].saddr;
+		__u8 key[ACL_LPM_KEY_MAX] = {};
+
+		if (!rule_in_family(&rules[i], family))
+			continue;
+
+		len = dst ? rules[i].dst_len : rules[i].src_len;
+		memcpy(key, &len, sizeof(len));
+		memcpy(key + sizeof(len), addr, alen);
+
+		for (j = 0; j < nr_keys; j++)
+			if (!memcmp(keys[j], key, key_size))
+				break;
+		if (j == nr_keys)
+			memcpy(keys[nr_keys++], key, key_size);
+	}
+
+	for (j = 0; j < nr_keys; j++) {
+		const __u8 *kaddr = keys[j] + sizeof(__u32);
+		__u64 bitmap = 0;
+
+		memcpy(&len, keys[j], sizeof(len));
+
+		for (i = 0; i < ACL_MAX_RULES; i++) {
+			const __u8 *addr = dst ? rules[i].daddr : rules[i].saddr;
+			__u8 plen = dst ? rules[i].dst_len : rules[i].src_len;
+
+			if (rule_in_family(&rules[i], family) && plen <= len &&
+			    prefix_contains(addr, plen, kaddr))
+				bitmap |= 1ULL << i;
+		}
+
+		if (bpf_map_update_elem(fd, keys[j], &bitmap, BPF_ANY))
+			return -errno;
+	}
+
+	return acl_table_prune(fd, keys, nr_keys, key_size);
+}
+
+static bool port_key_covers(const struct acl_rule *rule,
+			    const struct acl_port_key *key)
+{
+	if (!rule->proto)
+		return true;
+	if (rule->proto != key->proto)
+		return false;
+	return !rule->dport || rule->dport == key->dport;
+}
+
+static int acl_ports_rebuild(int fd, const struct acl_rule *rules)
+{
+	struct acl_port_key keys[ACL_MAX_RULES];
+	int nr_keys = 0, i, j;
+
+	for (i = 0; i < ACL_MAX_RULES; i++) {
+		struct acl_port_key key = {
+			.proto = rules[i].proto,
+			.dport = rules[i].dport,
+		};
+
+		if (rules[i].action == ACL_ACTION_NONE)
+			continue;
+
+		for (j = 0; j < nr_keys; j++)
+			if (!memcmp(&keys[j], &key, sizeof(key)))
+				break;
+		if (j == nr_keys)
+			keys[nr_keys++] = key;
+	}
+
+	for (j = 0; j < nr_keys; j++) {
+		__u64 bitmap = 0;
+
+		for (i = 0; i < ACL_MAX_RULES; i++)
+			if (rules[i].action != ACL_ACTION_NONE &&
+			    port_key_covers(&rules[i], &keys[j]))
+				bitmap |= 1ULL << i;
+
+		if (bpf_map_update_elem(fd, &keys[j], &bitmap, BPF_ANY))
+			return -errno;
+	}
+
+	return acl_table_prune(fd, keys, nr_keys, sizeof(keys[0]));
+}
+
+static int acl_tables_rebuild(const struct acl_maps *maps,
+			      const struct acl_rule *rules)
+{
+	int err;
+
+	err = acl_lpm_rebuild(maps->src_v4, rules, AF_INET, false);
+	if (!err)
+		err = acl_lpm_rebuild(maps->dst_v4, rules, AF_INET, true);
+	if (!err)
+		err = acl_lpm_rebuild(maps->src_v6, rules, AF_INET6, false);
+	if (!err)
+		err = acl_lpm_rebuild(maps->dst_v6, rules, AF_INET6, true);
+	if (!err)
+		err = acl_ports_rebuild(maps->ports, rules);
+
+	return err;
+}
+
+static int parse_prefix(const char *str, struct acl_rule *rule, __u8 *addr,
+			__u8 *len)
+{
+	char buf[INET6_ADDRSTRLEN + 4], *slash, *end;
+	unsigned long plen;
+	int family, max;
+
+	snprintf(buf, sizeof(buf), "%s", str);
+	slash = strchr(buf, '/');
+	if (slash)
+		*slash++ = '\0';
+
+	if (inet_pton(AF_INET, buf, addr) == 1)
+		family = AF_INET;
+	else if (inet_pton(AF_INET6, buf, addr) == 1)
+		family = AF_INET6;
+	else
+		return -EINVAL;
+
+	max = family == AF_INET ? 32 : 128;
+	plen = max;
+	if (slash) {
+		plen = strtoul(slash, &end, 10);
+		if (*end || plen > (unsigned long)max)
+			return -EINVAL;
+	}
+
+	if (rule->family && rule->family != family)
+		return -EINVAL;
+
+	rule->family = family;
+	*len = plen;
+	prefix_mask(addr, plen, family == AF_INET ? 4 : 16);
+	return 0;
+}
+
+static int parse_proto(const char *str, __u8 *proto)
+{
+	unsigned long val;
+	char *end;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(acl_proto_names); i++) {
+		if (!strcmp(str, acl_proto_names[i].name)) {
+			*proto = acl_proto_names[i].proto;
+			return 0;
+		}
+	}
+
+	val = strtoul(str, &end, 0);
+	if (*end || !val || val > 255)
+		return -EINVAL;
+
+	*proto = val;
+	return 0;
+}
+
+int acl_rule_parse(const char *spec, __u32 *slot, struct acl_rule *rule)
+{
+	char buf[256], *tok, *val, *end, *save = NULL;
+	unsigned long num;
+	bool has_slot = false;
+	size_t i;
+
+	memset(rule, 0, sizeof(*rule));
+	snprintf(buf, sizeof(buf), "%s", spec);
+
+	for (tok = strtok_r(buf, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (!val)
+			return -EINVAL;
+		*val++ = '\0';
+
+		if (!strcmp(tok, "prio")) {
+			num = strtoul(val, &end, 0);
+			if (*end || num >= ACL_MAX_RULES)
+				return -EINVAL;
+			*slot = num;
+			has_slot = true;
+		} else if (!strcmp(tok, "action")) {
+			for (i = ACL_ACTION_PASS; i < ARRAY_SIZE(acl_action_names); i++)
+				if (!strcmp(val, acl_action_names[i]))
+					rule->action = i;
+			if (rule->action == ACL_ACTION_NONE)
+				return -EINVAL;
+		} else if (!strcmp(tok, "src")) {
+			if (parse_prefix(val, rule, rule->saddr, &rule->src_len))
+				return -EINVAL;
+		} else if (!strcmp(tok, "dst")) {
+			if (parse_prefix(val, rule, rule->daddr, &rule->dst_len))
+				return -EINVAL;
+		} else if (!strcmp(tok, "proto")) {
+			if (parse_proto(val, &rule->proto))
+				return -EINVAL;
+		} else if (!strcmp(tok, "dport")) {
+			num = strtoul(val, &end, 0);
+			if (*end || !num || num > 65535)
+				return -EINVAL;
+			rule->dport = htons(num);
+		} else if (!strcmp(tok, "dev")) {
+			rule->ifindex = if_nametoindex(val);
+			if (!rule->ifindex)
+				return -ENODEV;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	if (!has_slot || rule->action == ACL_ACTION_NONE)
+		return -EINVAL;
+	/* A port is only meaningful for a given protocol */
+	if (rule->dport && !rule->proto)
+		return -EINVAL;
+	if ((rule->action == ACL_ACTION_REDIRECT) != !!rule->ifindex)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Install @rule in @slot, replacing the rule that was there, if any */
+int acl_rule_set(__u32 slot, const struct acl_rule *rule)
+{
+	struct acl_rule rules[ACL_MAX_RULES];
+	struct acl_maps maps;
+	int err;
+
+	if (slot >= ACL_MAX_RULES)
+		return -EINVAL;
+
+	err = acl_maps_open(&maps);
+	if (err)
+		return err;
+
+	err = acl_rules_read(&maps, rules);
+	if (err)
+		goto out;
+
+	/* The tables must not point at the slot while it changes action, or
+	 * the packets of the old match would get the new verdict: take the
+	 * old rule out first, like acl_rule_del() does.
+	 */
+	if (rules[slot].action != ACL_ACTION_NONE) {
+		memset(&rules[slot], 0, sizeof(rules[slot]));
+		err = acl_tables_rebuild(&maps, rules);
+		if (err)
+			goto out;
+	}
+
+	rules[slot] = *rule;
+	if (bpf_map_update_elem(maps.rules, &slot, rule, BPF_ANY)) {
+		err = -errno;
+		goto out;
+	}
+
+	err = acl_tables_rebuild(&maps, rules);
+out:
+	acl_maps_close(&maps);
+	return err;
+}
+
+int acl_rule_del(__u32 slot)
+{
+	struct acl_rule rules[ACL_MAX_RULES];
+	struct acl_maps maps;
+	int err;
+
+	if (slot >= ACL_MAX_RULES)
+		return -EINVAL;
+
+	err = acl_maps_open(&maps);
+	if (err)
+		return err;
+
+	err = acl_rules_read(&maps, rules);
+	if (err)
+		goto out;
+
+	/* Take the rule out of the tables before freeing its slot */
+	memset(&rules[slot], 0, sizeof(rules[slot]));
+	err = acl_tables_rebuild(&maps, rules);
+	if (err)
+		goto out;
+
+	if (bpf_map_update_elem(maps.rules, &slot, &rules[slot], BPF_ANY))
+		err = -errno;
+out:
+	acl_maps_close(&maps);
+	return err;
+}
+
+static void print_prefix(const char *name, __u8 family, const __u8 *addr,
+			 __u8 len)
+{
+	char buf[INET6_ADDRSTRLEN];
+
+	if (!len)
+		return;
+
+	inet_ntop(family, addr, buf, sizeof(buf));
+	printf(",%s=%s/%u", name, buf, len);
+}
+
+/* Print the rules in the format accepted by acl_rule_parse(), followed by
+ * their hit counters summed over all the CPUs.
+ */
+int acl_rules_print(void)
+{
+	struct acl_rule rules[ACL_MAX_RULES];
+	int nr_cpus = libbpf_num_possible_cpus();
+	struct acl_maps maps;
+	struct proc_stats *values;
+	__u32 slot;
+	int err, i;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	values = calloc(nr_cpus, sizeof(*values));
+	if (!values)
+		return -ENOMEM;
+
+	err = acl_maps_open(&maps);
+	if (err)
+		goto out_free;
+
+	err = acl_rules_read(&maps, rules);
+	if (err)
+		goto out;
+
+	for (slot = 0; slot < ACL_MAX_RULES; slot++) {
+		const struct acl_rule *rule = &rules[slot];
+		char ifname[IF_NAMESIZE];
+		__u64 packets = 0, bytes = 0;
+
+		if (rule->action == ACL_ACTION_NONE)
+			continue;
+
+		if (bpf_map_lookup_elem(maps.stats, &slot, values)) {
+			err = -errno;
+			goto out;
+		}
+		for (i = 0; i < nr_cpus; i++) {
+			packets += values[i].packets;
+			bytes += values[i].bytes;
+		}
+
+		printf("prio=%u,action=%s", slot, acl_action_names[rule->action]);
+		print_prefix("src", rule->family, rule->saddr, rule->src_len);
+		print_prefix("dst", rule->family, rule->daddr, rule->dst_len);
+		if (rule->proto)
+			printf(",proto=%u", rule->proto);
+		if (rule->dport)
+			printf(",dport=%u", ntohs(rule->dport));
+		if (rule->ifindex)
+			printf(",dev=%s", if_indextoname(rule->ifindex, ifname) ?
+			       ifname : "?");
+		printf("  %llu pkts %llu bytes\n", packets, bytes);
+	}
+
+out:
+	acl_maps_close(&maps);
+out_free:
+	free(values);
+	return err;
+}
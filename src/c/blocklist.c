@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Userspace side of the xdp_prog_blocklist source blocklist.
+ *
+ * A blocklist file holds one address or prefix per line, IPv4 or IPv6;
+ * blank lines and anything after a '#' are ignored. The whole file is read
+ * first, then each family goes into its pinned LPM trie with a single
+ * bpf_map_update_batch() call, so that hundreds of thousands of entries
+ * cost two syscalls instead of one each. The bloom filter has no keys and
+ * no batch operation: its networks are pushed one at a time once the tries
+ * are loaded, and each entry blocks as soon as its network is in.
+ *
+ * Loading adds to the entries already there. Nothing is ever removed from
+ * bl_bloom, see struct bl_bloom_key.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+
+/* Growing array of LPM keys of one family */
+struct bl_list {
+	void *keys;
+	size_t key_size;
+	__u32 nr;
+	__u32 max;
+};
+
+static int bl_list_add(struct bl_list *l, __u32 len, const __u8 *addr)
+{
+	__u8 *key;
+	void *keys;
+	__u32 max;
+
+	if (l->nr == BL_MAX_ENTRIES)
+		return -E2BIG;
+
+	if (l->nr == l->max) {
+		max = l->max ? 2 * l->max : 4096;
+		keys = realloc(l->keys, max * l->key_size);
+		if (!keys)
+			return -ENOMEM;
+		l->keys = keys;
+		l->max = max;
+	}
+
+	/* struct acl_v4_key or struct acl_v6_key */
+	key = (__u8 *)l->keys + l->nr++ * l->key_size;
+	memcpy(key, &len, sizeof(len));
+	memcpy(key + sizeof(len), addr, l->key_size - sizeof(len));
+	return 0;
+}
+
+/* ADDR[/LEN], no shorter than BL_MIN_PREFIX_V4 or BL_MIN_PREFIX_V6 */
+static int bl_parse(char *str, int *family, __u8 *addr, __u32 *len)
+{
+	char *slash, *end;
+	unsigned long plen;
+	__u32 min, max;
+
+	slash = strchr(str, '/');
+	if (slash)
+		*slash++ = '\0';
+
+	if (inet_pton(AF_INET, str, addr) == 1) {
+		*family = AF_INET;
+		min = BL_MIN_PREFIX_V4;
+		max = 32;
+	} else if (inet_pton(AF_INET6, str, addr) == 1) {
+		*family = AF_INET6;
+		min = BL_MIN_PREFIX_V6;
+		max = 128;
+	} else {
+		return -EINVAL;
+	}
+
+	plen = max;
+	if (slash) {
+		plen = strtoul(slash, &end, 10);
+		if (*end || plen < min || plen > max)
+			return -EINVAL;
+	}
+
+	*len = plen;
+	prefix_mask(addr, plen, max / 8);
+	return 0;
+}
+
+static int bl_batch(int fd, const struct bl_list *l)
+{
+	LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	__u32 count = l->nr;
+	__u8 *values;
+	int err = 0;
+
+	if (!l->nr)
+		return 0;
+
+	values = malloc(l->nr);
+	if (!values)
+		return -ENOMEM;
+	memset(values, 1, l->nr);
+
+	if (bpf_map_update_batch(fd, l->keys, values, &count, &opts))
+		err = -errno;
+
+	free(values);
+	return err;
+}
+
+/* Push into bl_bloom every bloom network the entry @addr/@len touches:
+ * its covering one, or all those it spans if it is shorter. The varying
+ * bits all fall in one word, see BL_MIN_PREFIX_V4 and BL_MIN_PREFIX_V6.
+ */
+static int bl_bloom_push(int fd, int family, const __u8 *addr, __u32 len,
+			 __u64 *nr)
+{
+	struct bl_bloom_key net = {};
+	__u32 bloom, word, shift, base, i;
+
+	bloom = family == AF_INET ? BL_BLOOM_PREFIX_V4 : BL_BLOOM_PREFIX_V6;
+	if (len > bloom)
+		len = bloom;
+
+	net.family = family;
+	memcpy(net.addr, addr, family == AF_INET ? 4 : 16);
+	prefix_mask((__u8 *)net.addr, bloom, sizeof(net.addr));
+
+	word = (bloom - 1) / 32;
+	shift = 32 * (word + 1) - bloom;
+	base = ntohl(net.addr[word]);
+
+	for (i = 0; i < 1U << (bloom - len); i++) {
+		net.addr[word] = htonl(base | i << shift);
+		if (bpf_map_update_elem(fd, NULL, &net, BPF_ANY))
+			return -errno;
+		(*nr)++;
+	}
+	return 0;
+}
+
+static int bl_bloom_fill(int fd, int family, const struct bl_list *l,
+			 __u64 *nr)
+{
+	const __u8 *key;
+	__u32 i, len;
+	int err;
+
+	for (i = 0; i < l->nr; i++) {
+		key = (const __u8 *)l->keys + i * l->key_size;
+		memcpy(&len, key, sizeof(len));
+		err = bl_bloom_push(fd, family, key + sizeof(len), len, nr);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static __u64 bl_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+int bl_load(const char *path)
+{
+	struct bl_list v4 = { .key_size = sizeof(struct acl_v4_key) };
+	struct bl_list v6 = { .key_size = sizeof(struct acl_v6_key) };
+	int bloom_fd = -1, v4_fd = -1, v6_fd = -1, family, err = 0;
+	char line[256], *p;
+	__u64 start, nr_bloom = 0;
+	__u32 lineno = 0, len;
+	__u8 addr[16];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		err = -errno;
+		fprintf(stderr, "ERR: cannot open %s: %s\n", path,
+			strerror(-err));
+		return err;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		p = line + strspn(line, " \t");
+		p[strcspn(p, "# \t\r\n")] = '\0';
+		if (!*p)
+			continue;
+
+		if (bl_parse(p, &family, addr, &len)) {
+			fprintf(stderr, "ERR: %s:%u: invalid entry %s\n", path,
+				lineno, p);
+			err = -EINVAL;
+			goto out;
+		}
+
+		err = bl_list_add(family == AF_INET ? &v4 : &v6, len, addr);
+		if (err)
+			goto out;
+	}
+
+	bloom_fd = open_pinned_map("bl_bloom");
+	if (bloom_fd < 0) {
+		err = bloom_fd;
+		goto out;
+	}
+	v4_fd = open_pinned_map("bl_v4");
+	if (v4_fd < 0) {
+		err = v4_fd;
+		goto out;
+	}
+	v6_fd = open_pinned_map("bl_v6");
+	if (v6_fd < 0) {
+		err = v6_fd;
+		goto out;
+	}
+
+	start = bl_now_ms();
+	err = bl_batch(v4_fd, &v4);
+	if (!err)
+		err = bl_batch(v6_fd, &v6);
+	if (!err)
+		err = bl_bloom_fill(bloom_fd, AF_INET, &v4, &nr_bloom);
+	if (!err)
+		err = bl_bloom_fill(bloom_fd, AF_INET6, &v6, &nr_bloom);
+	if (err)
+		goto out;
+
+	printf("%u IPv4 and %u IPv6 entries, %llu bloom networks, loaded in %llu ms\n",
+	       v4.nr, v6.nr, (unsigned long long)nr_bloom,
+	       (unsigned long long)(bl_now_ms() - start));
+
+out:
+	if (v6_fd >= 0)
+		close(v6_fd);
+	if (v4_fd >= 0)
+		close(v4_fd);
+	if (bloom_fd >= 0)
+		close(bloom_fd);
+	free(v6.keys);
+	free(v4.keys);
+	fclose(f);
+	return err;
+}
+
+static __u32 bl_count(int fd, size_t key_size)
+{
+	__u8 key[sizeof(struct acl_v6_key)], next[sizeof(struct acl_v6_key)];
+	void *prev = NULL;
+	__u32 nr = 0;
+
+	while (!bpf_map_get_next_key(fd, prev, next)) {
+		memcpy(key, next, key_size);
+		prev = key;
+		nr++;
+	}
+	return nr;
+}
+
+/* The size of each trie, then the counters summed over all the CPUs */
+int bl_print(void)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	int v4_fd = -1, v6_fd = -1, stats_fd = -1, err = 0;
+	struct bl_stats *values, sum = {};
+	__u32 key = 0;
+	int i;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	values = calloc(nr_cpus, sizeof(*values));
+	if (!values)
+		return -ENOMEM;
+
+	v4_fd = open_pinned_map("bl_v4");
+	if (v4_fd < 0) {
+		err = v4_fd;
+		goto out;
+	}
+	v6_fd = open_pinned_map("bl_v6");
+	if (v6_fd < 0) {
+		err = v6_fd;
+		goto out;
+	}
+	stats_fd = open_pinned_map("bl_stats");
+	if (stats_fd < 0) {
+		err = stats_fd;
+		goto out;
+	}
+
+	if (bpf_map_lookup_elem(stats_fd, &key, values)) {
+		err = -errno;
+		goto out;
+	}
+
+	for (i = 0; i < nr_cpus; i++) {
+		sum.bloom_miss += values[i].bloom_miss;
+		sum.bloom_hit += values[i].bloom_hit;
+		sum.blocked += values[i].blocked;
+	}
+
+	printf("%u IPv4 and %u IPv6 entries\n",
+	       bl_count(v4_fd, sizeof(struct acl_v4_key)),
+	       bl_count(v6_fd, sizeof(struct acl_v6_key)));
+	printf("%llu bloom misses %llu bloom hits %llu blocked\n",
+	       (unsigned long long)sum.bloom_miss,
+	       (unsigned long long)sum.bloom_hit,
+	       (unsigned long long)sum.blocked);
+
+out:
+	if (stats_fd >= 0)
+		close(stats_fd);
+	if (v6_fd >= 0)
+		close(v6_fd);
+	if (v4_fd >= 0)
+		close(v4_fd);
+	free(values);
+	return err;
+}
@@ -1,5 +1,248 @@
-
 #ifndef COMMON_HEADER_H
 #define COMMON_HEADER_H
 
+/* Definitions shared by the BPF programs and the userspace tools. The BPF
+ * side gets the kernel types from vmlinux.h, the userspace side from the UAPI
+ * headers (linux/types.h, linux/bpf.h); include one of them first.
+ */
+
+/* One slot of xdp_stats_map for each XDP action (XDP_ABORTED..XDP_REDIRECT) */
+#define XDP_ACTION_MAX		(XDP_REDIRECT + 1)
+
+/* Per-CPU value of xdp_stats_map, userspace sums all the CPUs on read */
+struct proc_stats {
+	__u64 packets;
+	__u64 bytes;
+};
+
+/* Sampled packet reported through the xdp_events ring buffer. Addresses and
+ * ports are in network byte order; IPv4 addresses use the first 4 bytes.
+ */
+struct xdp_event {
+	__u64 timestamp;	/* bpf_ktime_get_ns() */
+	__u32 ifindex;		/* ingress interface */
+	__u32 action;		/* XDP verdict */
+	__u8 saddr[16];
+	__u8 daddr[16];
+	__be16 sport;
+	__be16 dport;
+	__u8 family;		/* AF_INET or AF_INET6 */
+	__u8 proto;		/* L4 protocol */
+	__u8 pad[2];
+};
+
+/* Size of the xdp_events ring buffer: a power of 2, multiple of the page size */
+#define XDP_EVENTS_RINGBUF_SIZE	(256 * 1024)
+
+/* The producer wakes the consumer up only once this much data is pending, so
+ * that the reads are batched; the consumer polls with a timeout to pick up
+ * what is left behind when traffic stops.
+ */
+#define XDP_EVENTS_WAKEUP_BYTES	(16 * sizeof(struct xdp_event))
+
+/* Size of the xdp_tx_ports devmap of xdp_prog_router: the key is the
+ * egress ifindex, so this is also the largest ifindex it can forward to.
+ */
+#define XDP_TX_PORTS_MAX	256
+
+/* Size of the xsks_map of xdp_prog_xsk, keyed by RX queue index */
+#define XSK_MAX_QUEUES		64
+
+/* Longest chain of stages behind xdp_prog_dispatcher, the size of
+ * xdp_stages. Tail calls are limited to 33 per packet anyway.
+ */
+#define XDP_CHAIN_MAX		8
+
+/* ACL engine of xdp_prog_acl.
+ *
+ * Rules live in the acl_rules array and their slot number is their
+ * priority: when several rules match, the lowest slot wins. Each match table
+ * (source and destination prefix per family, protocol/port) maps a key to
+ * the bitmap of the rules that accept it, so a packet is classified with one
+ * lookup per table and an AND of the results. Userspace rebuilds the tables
+ * from acl_rules whenever a rule changes; the program never needs a reload.
+ */
+#define ACL_MAX_RULES		64
+
+enum acl_action {
+	ACL_ACTION_NONE = 0,	/* unused slot */
+	ACL_ACTION_PASS,
+	ACL_ACTION_DROP,
+	ACL_ACTION_REDIRECT,	/* bpf_redirect() to acl_rule.ifindex */
+	ACL_ACTION_COUNT,	/* account the packet, keep evaluating */
+};
+
+/* Value of acl_rules. The program only reads action and ifindex; the match
+ * fields are kept so that userspace can rebuild the tables from the map.
+ * Addresses and the port are in network byte order, IPv4 addresses use the
+ * first 4 bytes. A zero prefix length, protocol or port is a wildcard.
+ */
+struct acl_rule {
+	__u32 action;		/* enum acl_action */
+	__u32 ifindex;		/* ACL_ACTION_REDIRECT target */
+	__u8 family;		/* AF_INET, AF_INET6 or 0 for both */
+	__u8 proto;
+	__be16 dport;
+	__u8 src_len;
+	__u8 dst_len;
+	__u8 pad[2];
+	__u8 saddr[16];
+	__u8 daddr[16];
+};
+
+/* Keys of the acl_{src,dst}_v{4,6} and bl_v{4,6} LPM tries */
+struct acl_v4_key {
+	__u32 prefixlen;
+	__u8 addr[4];
+};
+
+struct acl_v6_key {
+	__u32 prefixlen;
+	__u8 addr[16];
+};
+
+/* Key of acl_ports. The program tries {proto, dport}, then {proto, 0}, then
+ * {0, 0}; the entries already include the rules of the wider keys.
+ */
+struct acl_port_key {
+	__u8 proto;
+	__u8 pad;
+	__be16 dport;
+};
+
+/* Per-source rate limiter of xdp_prog_ratelimit.
+ *
+ * Each packet falls in a class and each class has its own rate, burst and
+ * source prefix lengths in rl_classes. The sources are aggregated by prefix
+ * (a /64 is usually a single IPv6 host) and every {prefix, class} pair owns
+ * a token bucket in the rl_buckets LRU hash, so a flood of new sources
+ * evicts the idle buckets instead of failing. Excess packets are dropped in
+ * XDP, before the kernel allocates an skb for them.
+ */
+#define RL_MAX_SOURCES		65536
+
+enum rl_class {
+	RL_CLASS_ICMP = 0,	/* ICMP and ICMPv6 */
+	RL_CLASS_UDP,
+	RL_CLASS_TCP_SYN,	/* TCP SYN without ACK */
+	RL_CLASS_OTHER,		/* everything else, other TCP included */
+	RL_CLASS_MAX,
+};
+
+/* Value of rl_classes. The bucket is kept in nanoseconds of credit: a
+ * packet costs cost_ns = 1e9 / rate and the bucket holds at most
+ * depth_ns = burst * cost_ns, so refilling is a subtraction of timestamps
+ * and the program never divides. Userspace computes both from rate and
+ * burst; a zero rate leaves the class unlimited.
+ */
+struct rl_class_cfg {
+	__u32 rate;		/* packets per second */
+	__u32 burst;		/* packets */
+	__u64 cost_ns;
+	__u64 depth_ns;
+	__u8 prefix_v4;		/* source prefix length of a bucket */
+	__u8 prefix_v6;
+	__u8 pad[6];
+};
+
+/* Key of rl_buckets: the masked source address, IPv4 in the first word */
+struct rl_key {
+	__be32 addr[4];
+	__u8 family;		/* AF_INET or AF_INET6 */
+	__u8 class;		/* enum rl_class */
+	__u8 pad[2];
+};
+
+struct rl_bucket {
+	__u64 tokens_ns;	/* credit left at last_ns */
+	__u64 last_ns;		/* bpf_ktime_get_ns() of the last update */
+};
+
+/* Per-CPU value of rl_stats, one slot per class */
+struct rl_stats {
+	__u64 passed;
+	__u64 limited;
+};
+
+/* Source address blocklist of xdp_prog_blocklist.
+ *
+ * The blocked addresses and prefixes live in the bl_v4 and bl_v6 LPM tries,
+ * whose lookup gets slower as they grow. In front of them sits bl_bloom, a
+ * bloom filter of every BL_BLOOM_PREFIX_V4 / BL_BLOOM_PREFIX_V6 network
+ * that holds at least one blocked address: a source whose network is not
+ * in it is certainly not blocked and skips the tries, so the traffic that
+ * matches nothing, the bulk of it, pays a few hashes instead of a trie
+ * walk. Entries longer than the bloom prefix add their covering network,
+ * shorter ones add every network they span, hence the BL_MIN_PREFIX_*
+ * floor on their length.
+ *
+ * A bloom filter cannot forget: removing an entry from the tries leaves its
+ * network in bl_bloom, which only costs a trie lookup to its neighbours
+ * until the map is unpinned and the program reloaded.
+ */
+#define BL_MAX_ENTRIES		(1 << 20)	/* per family */
+#define BL_BLOOM_ENTRIES	(1 << 21)
+#define BL_BLOOM_PREFIX_V4	24
+#define BL_BLOOM_PREFIX_V6	48
+#define BL_MIN_PREFIX_V4	(BL_BLOOM_PREFIX_V4 - 16)
+#define BL_MIN_PREFIX_V6	(BL_BLOOM_PREFIX_V6 - 16)
+
+/* Value of bl_bloom: the masked network, IPv4 in the first word */
+struct bl_bloom_key {
+	__be32 addr[4];
+	__u32 family;		/* AF_INET or AF_INET6 */
+};
+
+/* Per-CPU value of bl_stats */
+struct bl_stats {
+	__u64 bloom_miss;	/* skipped the tries */
+	__u64 bloom_hit;	/* looked up in the tries */
+	__u64 blocked;		/* found there and dropped */
+};
+
+/* SYN flood mitigation of xdp_prog_syncookie.
+ *
+ * For the TCP ports in syncookie_listeners the program answers every SYN
+ * itself, with a SYN-ACK that carries a SYN cookie and goes back out with
+ * XDP_TX, so a flood never reaches the listener. The ACK that completes the
+ * handshake is checked against the cookie and passed to the stack, which
+ * rebuilds the connection from it; ACKs that match neither a socket nor a
+ * valid cookie are dropped.
+ *
+ * The kernel only accepts cookies on a listener for a while after sending
+ * some itself: with net.ipv4.tcp_syncookies=2 it answers every SYN with a
+ * cookie, and the program lets one SYN per listener through to it every
+ * SYNCOOKIE_REFRESH_NS to keep that window open.
+ */
+#define SYNCOOKIE_MAX_LISTENERS	64
+#define SYNCOOKIE_REFRESH_NS	(30ULL * 1000000000ULL)
+
+/* Value of syncookie_listeners, keyed by TCP port in host byte order */
+struct syncookie_listener {
+	__u64 refresh_ns;	/* last SYN let through to the stack */
+};
+
+/* Per-CPU value of syncookie_stats */
+struct syncookie_stats {
+	__u64 syn_cookies;	/* SYN-ACKs sent from XDP */
+	__u64 syn_passed;	/* SYNs let through, see SYNCOOKIE_REFRESH_NS */
+	__u64 ack_valid;	/* handshakes completed with a cookie */
+	__u64 ack_invalid;	/* ACKs dropped */
+};
+
+/* pcount, the BPF port of packet_counter. pcount_stats has one slot for each
+ * family and netfilter hook: IPv4 at 0..3, IPv6 at 4..7, each in NF_INET_*
+ * order (PRE_ROUTING, LOCAL_IN, FORWARD, LOCAL_OUT). pcount_ports is indexed
+ * by destination port.
+ */
+#define PCOUNT_NR_HOOKS		8
+#define PCOUNT_NR_PORTS		65536
+
+/* Per-CPU value of pcount_stats */
+struct pcount_stats {
+	__u64 tcp;
+	__u64 udp;
+	__u64 total;
+};
+
 #endif // COMMON_HEADER_H
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+
+#define NANOSEC_PER_SEC 1000000000ULL
+
+static const char *xdp_action_names[XDP_ACTION_MAX] = {
+	[XDP_ABORTED]	= "XDP_ABORTED",
+	[XDP_DROP]	= "XDP_DROP",
+	[XDP_PASS]	= "XDP_PASS",
+	[XDP_TX]	= "XDP_TX",
+	[XDP_REDIRECT]	= "XDP_REDIRECT",
+};
+
+const char *xdp_action2str(__u32 action)
+{
+	if (action < XDP_ACTION_MAX)
+		return xdp_action_names[action];
+	return NULL;
+}
+
+static __u64 gettime(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (__u64)t.tv_sec * NANOSEC_PER_SEC + t.tv_nsec;
+}
+
+/* A lookup in a per-CPU map returns one value for each possible CPU; fold
+ * them here so that the BPF side never needs an atomic operation.
+ */
+int stats_collect(int map_fd, struct stats_record *rec)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	__u32 key;
+	int i;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	struct proc_stats values[nr_cpus];
+
+	memset(rec, 0, sizeof(*rec));
+	rec->timestamp = gettime();
+
+	for (key = 0; key < XDP_ACTION_MAX; key++) {
+		if (bpf_map_lookup_elem(map_fd, &key, values))
+			return -errno;
+
+		for (i = 0; i < nr_cpus; i++) {
+			rec->action[key].packets += values[i].packets;
+			rec->action[key].bytes += values[i].bytes;
+		}
+	}
+
+	return 0;
+}
+
+/* Print the totals of @rec and, when @prev is given, the rates since then */
+void stats_print(const struct stats_record *rec,
+		 const struct stats_record *prev)
+{
+	double period = 0;
+	__u32 key;
+
+	if (prev && rec->timestamp > prev->timestamp)
+		period = (double)(rec->timestamp - prev->timestamp) /
+			 NANOSEC_PER_SEC;
+
+	for (key = 0; key < XDP_ACTION_MAX; key++) {
+		const struct proc_stats *cur = &rec->action[key];
+		double pps = 0, bps = 0;
+
+		if (period > 0) {
+			pps = (cur->packets - prev->action[key].packets) / period;
+			bps = (cur->bytes - prev->action[key].bytes) * 8 / period;
+		}
+
+		printf("%-12s %12llu pkts (%10.0f pps) %14llu bytes (%8.2f Mbit/s)\n",
+		       xdp_action2str(key), cur->packets, pps, cur->bytes,
+		       bps / 1000000);
+	}
+}
+
+/* Open the map pinned at @path, saying why it failed; -errno on error */
+int open_pinned_path(const char *path)
+{
+	int fd;
+
+	fd = bpf_obj_get(path);
+	if (fd < 0) {
+		fd = -errno;
+		fprintf(stderr, "ERR: cannot open pinned map %s: %s\n", path,
+			strerror(-fd));
+	}
+	return fd;
+}
+
+/* Same for the map @name pinned under NETPROG_MAPS_DIR */
+int open_pinned_map(const char *name)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/%s", NETPROG_MAPS_DIR, name);
+	return open_pinned_path(path);
+}
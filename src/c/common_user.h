@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef COMMON_USER_H
+#define COMMON_USER_H
+
+#include <stddef.h>
+#include <linux/types.h>
+#include <linux/bpf.h>
+
+#include "common.h"
+
+/* Layout of the BPF filesystem used by the test scripts and the tools */
+#define NETPROG_PIN_DIR		"/sys/fs/bpf/netprog"
+#define NETPROG_MAPS_DIR	NETPROG_PIN_DIR "/maps"
+#define NETPROG_LINKS_DIR	NETPROG_PIN_DIR "/links"
+#define NETPROG_STATS_MAP	NETPROG_MAPS_DIR "/xdp_stats_map"
+#define NETPROG_EVENTS_MAP	NETPROG_MAPS_DIR "/xdp_events"
+#define NETPROG_XSKS_MAP	NETPROG_MAPS_DIR "/xsks_map"
+
+#define PCOUNT_PIN_DIR		"/sys/fs/bpf/pcount"
+#define PCOUNT_MAPS_DIR		PCOUNT_PIN_DIR "/maps"
+#define PCOUNT_LINKS_DIR	PCOUNT_PIN_DIR "/links"
+
+/* Snapshot of xdp_stats_map, already summed over all the possible CPUs */
+struct stats_record {
+	__u64 timestamp;	/* CLOCK_MONOTONIC, ns */
+	struct proc_stats action[XDP_ACTION_MAX];
+};
+
+const char *xdp_action2str(__u32 action);
+
+int stats_collect(int map_fd, struct stats_record *rec);
+void stats_print(const struct stats_record *rec,
+		 const struct stats_record *prev);
+
+int open_pinned_path(const char *path);
+int open_pinned_map(const char *name);
+
+/* xdp_prog_acl rules, through the maps pinned in NETPROG_MAPS_DIR (acl.c) */
+int acl_rule_parse(const char *spec, __u32 *slot, struct acl_rule *rule);
+int acl_rule_set(__u32 slot, const struct acl_rule *rule);
+int acl_rule_del(__u32 slot);
+int acl_rules_print(void);
+void prefix_mask(__u8 *addr, __u8 len, size_t size);
+
+/* xdp_prog_ratelimit classes, through the maps pinned in NETPROG_MAPS_DIR
+ * (ratelimit.c)
+ */
+int rl_class_parse(const char *spec, __u32 *class, struct rl_class_cfg *cfg);
+int rl_class_set(__u32 class, const struct rl_class_cfg *cfg);
+int rl_classes_print(void);
+
+/* xdp_prog_syncookie listeners, through the maps pinned in NETPROG_MAPS_DIR
+ * (syncookie.c)
+ */
+int syncookie_listener_add(__u16 port);
+int syncookie_listener_del(__u16 port);
+int syncookie_print(void);
+
+/* xdp_prog_blocklist entries, through the maps pinned in NETPROG_MAPS_DIR
+ * (blocklist.c)
+ */
+int bl_load(const char *path);
+int bl_print(void);
+
+#endif /* COMMON_USER_H */
@@ -5,158 +5,1198 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 
-#define ETH_P_IPV6		0x86DD	/* IPv6 */
-#define IPPROTO_ICMPV6		58	/* ICMPv6 */
+#include "common.h"
+#include "parsing_helpers.h"
 
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct proc_stats);
+	__uint(max_entries, XDP_ACTION_MAX);
+} xdp_stats_map SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, XDP_EVENTS_RINGBUF_SIZE);
+} xdp_events SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__type(key, __u32);
+	__type(value, struct acl_rule);
+	__uint(max_entries, ACL_MAX_RULES);
+} acl_rules SEC(".maps");
+
+/* Hits of each rule of acl_rules */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct proc_stats);
+	__uint(max_entries, ACL_MAX_RULES);
+} acl_rule_stats SEC(".maps");
+
+/* ACL match tables, the values are bitmaps of acl_rules slots */
+#define ACL_LPM_MAP(_name, _key)				\
+struct {							\
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);			\
+	__type(key, struct _key);				\
+	__type(value, __u64);					\
+	__uint(max_entries, ACL_MAX_RULES);			\
+	__uint(map_flags, BPF_F_NO_PREALLOC);			\
+} _name SEC(".maps")
 
-/* Byte-count bounds check; check if current pointer at @start + @off of header
- * is after @end.
+ACL_LPM_MAP(acl_src_v4, acl_v4_key);
+ACL_LPM_MAP(acl_dst_v4, acl_v4_key);
+ACL_LPM_MAP(acl_src_v6, acl_v6_key);
+ACL_LPM_MAP(acl_dst_v6, acl_v6_key);
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, struct acl_port_key);
+	__type(value, __u64);
+	__uint(max_entries, 2 * ACL_MAX_RULES + 1);
+} acl_ports SEC(".maps");
+
+/* Egress ports of xdp_prog_router, keyed by ifindex. The loader adds every
+ * interface it attaches to; bpf_redirect_map() only forwards to those.
  */
-#define __may_pull(start, off, end) \
-	(((unsigned char *)(start)) + (off) <= ((unsigned char *)(end)))
+struct {
+	__uint(type, BPF_MAP_TYPE_DEVMAP);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, XDP_TX_PORTS_MAX);
+} xdp_tx_ports SEC(".maps");
 
-/* LLVM maps __sync_fetch_and_add() as a built-in function to the BPF atomic add
- * instruction (that is BPF_STX | BPF_XADD | BPF_W for word sizes)
+/* AF_XDP sockets of xdp_prog_xsk, keyed by RX queue: xdp_xsk binds a socket
+ * to one queue of the interface and stores it in the slot of that queue.
  */
-#ifndef lock_xadd
-#define lock_xadd(ptr, val)	((void) __sync_fetch_and_add(ptr, val))
-#endif
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, XSK_MAX_QUEUES);
+} xsks_map SEC(".maps");
+
+/* Stages of the xdp_prog_dispatcher chain, in order: the dispatcher
+ * tail-calls slot 0 and every stage that lets the packet through tail-calls
+ * the next slot. The first empty slot ends the chain. netprog -c fills it.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_PROG_ARRAY);
+	__type(key, __u32);
+	__type(value, __u32);
+	__uint(max_entries, XDP_CHAIN_MAX);
+} xdp_stages SEC(".maps");
 
-struct proc_stats {
-	__u64 drop;
+/* What the dispatcher learnt about the packet, for the stages to read
+ * instead of parsing the headers again. XDP runs a packet to completion on
+ * one CPU, tail calls included, so a per-CPU slot is never shared by two
+ * packets at a time. The offsets stay valid as long as no stage moves the
+ * packet head or tail.
+ */
+struct xdp_scratch {
+	struct packet_info pkt;
+	__u32 stage;		/* xdp_stages slot of the running stage */
 };
 
-#define XDP_STATS_MAP_NELEM_MAX 1
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct xdp_scratch);
+	__uint(max_entries, 1);
+} xdp_scratch SEC(".maps");
+
+/* Token-bucket rate limiter, see struct rl_class_cfg */
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
 	__type(key, __u32);
-	__type(value, struct proc_stats);
-	__uint(max_entries, XDP_STATS_MAP_NELEM_MAX);
-} xdp_stats_map SEC(".maps");
+	__type(value, struct rl_class_cfg);
+	__uint(max_entries, RL_CLASS_MAX);
+} rl_classes SEC(".maps");
 
-/* Header cursor to keep track of current parsing position */
-struct hdr_cursor {
-	void *pos;
-};
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__type(key, struct rl_key);
+	__type(value, struct rl_bucket);
+	__uint(max_entries, RL_MAX_SOURCES);
+} rl_buckets SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct rl_stats);
+	__uint(max_entries, RL_CLASS_MAX);
+} rl_stats SEC(".maps");
+
+/* SYN cookies of xdp_prog_syncookie, see struct syncookie_listener */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__type(key, __u16);
+	__type(value, struct syncookie_listener);
+	__uint(max_entries, SYNCOOKIE_MAX_LISTENERS);
+} syncookie_listeners SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct syncookie_stats);
+	__uint(max_entries, 1);
+} syncookie_stats SEC(".maps");
+
+/* Source blocklist of xdp_prog_blocklist, see struct bl_bloom_key */
+struct {
+	__uint(type, BPF_MAP_TYPE_BLOOM_FILTER);
+	__type(value, struct bl_bloom_key);
+	__uint(max_entries, BL_BLOOM_ENTRIES);
+} bl_bloom SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct acl_v4_key);
+	__type(value, __u8);
+	__uint(max_entries, BL_MAX_ENTRIES);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+} bl_v4 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_LPM_TRIE);
+	__type(key, struct acl_v6_key);
+	__type(value, __u8);
+	__uint(max_entries, BL_MAX_ENTRIES);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+} bl_v6 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct bl_stats);
+	__uint(max_entries, 1);
+} bl_stats SEC(".maps");
+
+/* Report one packet out of every event_sample_rate (on average) through
+ * xdp_events; 0, the default, disables the stream. It lives in .bss so that
+ * the consumer can tune it at runtime, without reloading the program.
+ */
+__u32 event_sample_rate = 0;
+
+/* Account the packet under the verdict the program is about to return. Each
+ * CPU owns its copy of the record, so no atomic operation is needed; the
+ * userspace side sums the per-CPU values on read.
+ */
+static __always_inline __u32
+xdp_stats_record_action(struct xdp_md *ctx, __u32 action)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct proc_stats *pstats;
+
+	if (action >= XDP_ACTION_MAX)
+		return XDP_ABORTED;
+
+	pstats = bpf_map_lookup_elem(&xdp_stats_map, &action);
+	if (!pstats)
+		return XDP_ABORTED;
+
+	pstats->packets++;
+	pstats->bytes += data_end - data;
+
+	return action;
+}
+
+/* Reserve a sample in xdp_events and fill in the fields that do not depend
+ * on the packet headers. Returns NULL when the packet is not sampled or the
+ * ring buffer is full.
+ */
+static __always_inline struct xdp_event *
+xdp_event_reserve(struct xdp_md *ctx, __u32 action)
+{
+	__u32 rate = event_sample_rate;
+	struct xdp_event *e;
+
+	if (!rate || bpf_get_prandom_u32() % rate)
+		return NULL;
+
+	e = bpf_ringbuf_reserve(&xdp_events, sizeof(*e), 0);
+	if (!e)
+		return NULL;
+
+	__builtin_memset(e, 0, sizeof(*e));
+	e->timestamp = bpf_ktime_get_ns();
+	e->ifindex = ctx->ingress_ifindex;
+	e->action = action;
+
+	return e;
+}
+
+static __always_inline void xdp_event_submit(struct xdp_event *e)
+{
+	__u64 flags = BPF_RB_NO_WAKEUP;
+
+	/* Batch the notifications, see XDP_EVENTS_WAKEUP_BYTES */
+	if (bpf_ringbuf_query(&xdp_events, BPF_RB_AVAIL_DATA) >=
+	    XDP_EVENTS_WAKEUP_BYTES)
+		flags = BPF_RB_FORCE_WAKEUP;
+
+	bpf_ringbuf_submit(e, flags);
+}
+
+/* Sample a packet whose headers have been parsed into @pkt */
+static __always_inline void
+xdp_event_packet(struct xdp_md *ctx, const struct packet_info *pkt,
+		 __u32 action)
+{
+	struct xdp_event *e;
+
+	e = xdp_event_reserve(ctx, action);
+	if (!e)
+		return;
+
+	e->family = pkt->l3_proto == ETH_P_IPV6 ? AF_INET6 : AF_INET;
+	e->proto = pkt->l4_proto;
+	e->sport = pkt->sport;
+	e->dport = pkt->dport;
+	__builtin_memcpy(e->saddr, &pkt->saddr, sizeof(e->saddr));
+	__builtin_memcpy(e->daddr, &pkt->daddr, sizeof(e->daddr));
+	xdp_event_submit(e);
+}
 
 SEC("xdp")
 int  xdp_prog_pass(struct xdp_md *ctx)
 {
-	return XDP_PASS;
+	return xdp_stats_record_action(ctx, XDP_PASS);
 }
 
 static __always_inline int
-parse_ethhdr(struct hdr_cursor *nh, void *data_end, struct ethhdr **ethhdr)
+process_ipv6hdr(struct xdp_md *ctx, const struct packet_info *pkt)
 {
-	struct ethhdr *eth = nh->pos;
-	int hdrsize = sizeof(*eth);
-	__u16 h_proto;
+	/* Do processing based on the IPv6 upper layer protocol, found past the
+	 * extension headers. In this specific case, drop any ICMPv6 packet.
+	 */
+	if (pkt->l4_proto != IPPROTO_ICMPV6)
+		return XDP_PASS;
+
+	xdp_event_packet(ctx, pkt, XDP_DROP);
+	return XDP_DROP;
+}
 
-	if (!__may_pull(eth, hdrsize, data_end))
-		return -EINVAL;
+SEC("xdp")
+int  xdp_prog_drop_icmpv6(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct packet_info pkt;
+	struct hdr_cursor nh;
+	__u32 action = XDP_PASS;
 
-	/* Move the cursor ahead as we have parsed the ethernet header */
-	nh->pos += hdrsize;
-	/* network-byte-order */
-	h_proto = eth->h_proto;
+	/* These keep track of the next header type and interator pointer */
+	nh.pos = data;
 
-	if (ethhdr)
-		*ethhdr = eth;
+	if (parse_packet(&nh, data_end, &pkt) < 0)
+		/* we cannot parse the headers; instead of droppig the
+		 * packet we allow it to go in the kernel networking stack to
+		 * be further processed.
+		 */
+		goto out;
 
-	return h_proto;
+	switch (pkt.l3_proto) {
+	case ETH_P_IPV6:
+		action = process_ipv6hdr(ctx, &pkt);
+		break;
+	};
+
+	/* Pass the packet to the upper kernel networking */
+out:
+	return xdp_stats_record_action(ctx, action);
 }
 
-static __always_inline int
-parse_ip6hdr(struct hdr_cursor *nh, void *data_end, struct ipv6hdr **ip6hdr)
+/* Shared by xdp_prog_xsk and the xsk stage of xdp_prog_dispatcher */
+static __always_inline __u32
+xsk_steer(struct xdp_md *ctx, const struct packet_info *pkt)
 {
-	struct ipv6hdr *ip6h = nh->pos;
-	int hdrsize = sizeof(*ip6h);
+	if (pkt->l3_proto != ETH_P_IPV6 || pkt->l4_proto != IPPROTO_ICMPV6 ||
+	    (pkt->icmp_type != ICMPV6_ECHO_REQUEST &&
+	     pkt->icmp_type != ICMPV6_ECHO_REPLY))
+		return XDP_PASS;
 
-	/* Pointer-arithmetic bounds check; pointer +1 points to after end of
-	 * thing being pointed to.
-	 */
-	if (!__may_pull(ip6h, hdrsize, data_end))
-		return -EINVAL;
+	return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+/* Steer the ICMPv6 echo traffic, i.e. the pings that xdp_prog_drop_icmpv6
+ * drops, to the AF_XDP socket bound to the receiving queue: the frame goes
+ * straight into the socket's UMEM and the kernel never allocates an skb for
+ * it. Neighbour discovery and every other packet go on to the stack, and so
+ * do the pings of a queue with no socket (the XDP_PASS fallback of
+ * bpf_redirect_map()).
+ */
+SEC("xdp")
+int  xdp_prog_xsk(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct packet_info pkt;
+	struct hdr_cursor nh;
+	__u32 action = XDP_PASS;
 
-	nh->pos += hdrsize;
+	nh.pos = data;
 
-	if (ip6hdr)
-		*ip6hdr = ip6h;
+	if (parse_packet(&nh, data_end, &pkt) < 0)
+		goto out;
 
-	return ip6h->nexthdr;
+	action = xsk_steer(ctx, &pkt);
+out:
+	return xdp_stats_record_action(ctx, action);
 }
 
-static __always_inline int
-process_ipv6hdr(struct hdr_cursor *nh, void *data_end)
+/* Bitmap of the rules matching the addresses of @pkt, 0 if none */
+static __always_inline __u64 acl_match_addr(const struct packet_info *pkt)
+{
+	struct acl_v6_key key6 = { .prefixlen = 128 };
+	struct acl_v4_key key4 = { .prefixlen = 32 };
+	__u64 *src, *dst;
+
+	if (pkt->l3_proto == ETH_P_IP) {
+		__builtin_memcpy(key4.addr, &pkt->saddr.v4, sizeof(key4.addr));
+		src = bpf_map_lookup_elem(&acl_src_v4, &key4);
+		if (!src)
+			return 0;
+
+		__builtin_memcpy(key4.addr, &pkt->daddr.v4, sizeof(key4.addr));
+		dst = bpf_map_lookup_elem(&acl_dst_v4, &key4);
+	} else {
+		__builtin_memcpy(key6.addr, &pkt->saddr.v6, sizeof(key6.addr));
+		src = bpf_map_lookup_elem(&acl_src_v6, &key6);
+		if (!src)
+			return 0;
+
+		__builtin_memcpy(key6.addr, &pkt->daddr.v6, sizeof(key6.addr));
+		dst = bpf_map_lookup_elem(&acl_dst_v6, &key6);
+	}
+
+	return dst ? *src & *dst : 0;
+}
+
+/* Bitmap of the rules matching the protocol and destination port of @pkt.
+ * Non-first fragments carry no port and only match port wildcards.
+ */
+static __always_inline __u64 acl_match_port(const struct packet_info *pkt)
 {
+	struct acl_port_key key = {
+		.proto = pkt->l4_proto,
+		.dport = pkt->dport,
+	};
+	__u64 *rules;
+
+	rules = bpf_map_lookup_elem(&acl_ports, &key);
+	if (rules)
+		return *rules;
+
+	key.dport = 0;
+	rules = bpf_map_lookup_elem(&acl_ports, &key);
+	if (rules)
+		return *rules;
+
+	key.proto = 0;
+	rules = bpf_map_lookup_elem(&acl_ports, &key);
+	return rules ? *rules : 0;
+}
+
+static __always_inline void
+acl_rule_account(struct xdp_md *ctx, __u32 slot)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
 	struct proc_stats *pstats;
-	struct ipv6hdr *ip6h;
-	const int key = 0;
-	int nexthdr;
 
-	nexthdr = parse_ip6hdr(nh, data_end, &ip6h);
-	if (nexthdr < 0)
+	pstats = bpf_map_lookup_elem(&acl_rule_stats, &slot);
+	if (!pstats)
+		return;
+
+	pstats->packets++;
+	pstats->bytes += data_end - data;
+}
+
+/* Verdict of an explicit ACL pass rule: XDP_PASS, but final for the chain
+ * of xdp_prog_dispatcher, so that the stages after the ACL cannot limit or
+ * drop traffic the operator allowed. Never handed back to the kernel.
+ */
+#define XDP_ACCEPT		(XDP_REDIRECT + 1)
+
+/* Walk the matching rules in priority order: COUNT rules are accounted and
+ * skipped, the first other rule decides the verdict. A pass rule returns
+ * XDP_ACCEPT, no matching rule XDP_PASS.
+ */
+static __always_inline __u32
+acl_classify(struct xdp_md *ctx, const struct packet_info *pkt)
+{
+	struct acl_rule *rule;
+	__u64 matched;
+	__u32 i;
+
+	matched = acl_match_addr(pkt);
+	if (matched)
+		matched &= acl_match_port(pkt);
+
+	for (i = 0; i < ACL_MAX_RULES && matched; i++) {
+		if (!(matched & (1ULL << i)))
+			continue;
+		matched &= ~(1ULL << i);
+
+		rule = bpf_map_lookup_elem(&acl_rules, &i);
+		if (!rule)
+			break;
+
+		acl_rule_account(ctx, i);
+
+		switch (rule->action) {
+		case ACL_ACTION_PASS:
+			return XDP_ACCEPT;
+		case ACL_ACTION_DROP:
+			xdp_event_packet(ctx, pkt, XDP_DROP);
+			return XDP_DROP;
+		case ACL_ACTION_REDIRECT:
+			return bpf_redirect(rule->ifindex, 0);
+		}
+	}
+
+	return XDP_PASS;
+}
+
+SEC("xdp")
+int  xdp_prog_acl(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct packet_info pkt;
+	struct hdr_cursor nh;
+	__u32 action = XDP_PASS;
+
+	nh.pos = data;
+
+	/* Unparsable and non-IP traffic is left to the kernel stack */
+	if (parse_packet(&nh, data_end, &pkt) < 0)
+		goto out;
+
+	action = acl_classify(ctx, &pkt);
+	if (action == XDP_ACCEPT)
+		action = XDP_PASS;
+out:
+	return xdp_stats_record_action(ctx, action);
+}
+
+static __always_inline __u32 rl_classify(const struct packet_info *pkt)
+{
+	switch (pkt->l4_proto) {
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		return RL_CLASS_ICMP;
+	case IPPROTO_UDP:
+		return RL_CLASS_UDP;
+	case IPPROTO_TCP:
+		if ((pkt->tcp_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) ==
+		    TCP_FLAG_SYN)
+			return RL_CLASS_TCP_SYN;
+		break;
+	}
+
+	return RL_CLASS_OTHER;
+}
+
+/* Source address of @pkt, masked to the prefix length of its class */
+static __always_inline void
+rl_key_build(const struct packet_info *pkt, const struct rl_class_cfg *cc,
+	     __u32 class, struct rl_key *key)
+{
+	const __be32 *src = (const __be32 *)&pkt->saddr;
+	int i, len;
+
+	if (pkt->l3_proto == ETH_P_IP) {
+		key->family = AF_INET;
+		len = cc->prefix_v4;
+	} else {
+		key->family = AF_INET6;
+		len = cc->prefix_v6;
+	}
+	key->class = class;
+
+#pragma unroll
+	for (i = 0; i < 4; i++, len -= 32) {
+		if (key->family == AF_INET && i)
+			break;
+
+		if (len >= 32)
+			key->addr[i] = src[i];
+		else if (len > 0)
+			key->addr[i] = src[i] & bpf_htonl(~0U << (32 - len));
+	}
+}
+
+/* Take a token from the bucket of the source of @pkt. Two CPUs updating the
+ * same bucket at the same time may both let a packet through: the limit is
+ * approximate by one packet per racing CPU, in exchange for no lock on the
+ * fast path.
+ */
+static __always_inline __u32
+rl_limit(struct xdp_md *ctx, const struct packet_info *pkt)
+{
+	const struct rl_class_cfg *cc;
+	struct rl_key key = {};
+	struct rl_bucket *b, nb;
+	struct rl_stats *st;
+	__u64 now, tokens;
+	__u32 class;
+
+	class = rl_classify(pkt);
+	cc = bpf_map_lookup_elem(&rl_classes, &class);
+	st = bpf_map_lookup_elem(&rl_stats, &class);
+	if (!cc || !st)
 		return XDP_PASS;
 
-	/* Do processing based on the IPv6 next header. In this specific case,
-	 * drop any ICMPv6 packet.
-	 */
-	if (nexthdr != IPPROTO_ICMPV6)
+	if (!cc->cost_ns) {
+		st->passed++;
 		return XDP_PASS;
+	}
 
-	/* Lookup in kernel BPF-side return pointer to stats record */
-	pstats = bpf_map_lookup_elem(&xdp_stats_map, &key);
-	if (!pstats) {
-		/* BPF kernel-side verifier will reject program if the
-		 * NULL pointer check isn't performed here. Even-though
-		 * this is a static array where we know key lookup
-		 * XDP_PASS always will succeed.
-		 */
-		bpf_printk("XDP: Cannot access to proc stats, weird!?! Abort!");
-		return XDP_ABORTED;
+	rl_key_build(pkt, cc, class, &key);
+	now = bpf_ktime_get_ns();
+
+	b = bpf_map_lookup_elem(&rl_buckets, &key);
+	if (!b) {
+		/* A new source starts with a full bucket */
+		nb.tokens_ns = cc->depth_ns - cc->cost_ns;
+		nb.last_ns = now;
+		bpf_map_update_elem(&rl_buckets, &key, &nb, BPF_NOEXIST);
+		st->passed++;
+		return XDP_PASS;
 	}
 
+	/* Another CPU may have stored a later timestamp in the meantime */
+	tokens = b->tokens_ns;
+	if (now > b->last_ns)
+		tokens += now - b->last_ns;
+	if (tokens > cc->depth_ns)
+		tokens = cc->depth_ns;
+	b->last_ns = now;
+
+	if (tokens < cc->cost_ns) {
+		b->tokens_ns = tokens;
+		st->limited++;
+		xdp_event_packet(ctx, pkt, XDP_DROP);
+		return XDP_DROP;
+	}
 
-	/* Multiple CPUs can access data record. Thus, the accounting needs to
-	 * use an atomic operation.
+	b->tokens_ns = tokens - cc->cost_ns;
+	st->passed++;
+	return XDP_PASS;
+}
+
+SEC("xdp")
+int  xdp_prog_ratelimit(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct packet_info pkt;
+	struct hdr_cursor nh;
+	__u32 action = XDP_PASS;
+
+	nh.pos = data;
+
+	if (parse_packet(&nh, data_end, &pkt) < 0)
+		goto out;
+
+	action = rl_limit(ctx, &pkt);
+out:
+	return xdp_stats_record_action(ctx, action);
+}
+
+/* Drop the packets whose source is in the blocklist. The bloom filter is
+ * asked first about the network of the source; only when it may hold a
+ * blocked address does the packet pay for the LPM lookup.
+ */
+static __always_inline __u32
+bl_check(struct xdp_md *ctx, const struct packet_info *pkt)
+{
+	const __be32 *src = (const __be32 *)&pkt->saddr;
+	struct bl_bloom_key net = {};
+	struct acl_v6_key key6;
+	struct acl_v4_key key4;
+	struct bl_stats *st;
+	__u32 zero = 0;
+	void *hit;
+
+	st = bpf_map_lookup_elem(&bl_stats, &zero);
+	if (!st)
+		return XDP_PASS;
+
+	/* The bloom prefixes fall in the first word for IPv4, the second
+	 * one for IPv6
 	 */
-	lock_xadd(&pstats->drop, 1);
+	if (pkt->l3_proto == ETH_P_IP) {
+		net.family = AF_INET;
+		net.addr[0] = src[0] &
+			      bpf_htonl(~0U << (32 - BL_BLOOM_PREFIX_V4));
+	} else if (pkt->l3_proto == ETH_P_IPV6) {
+		net.family = AF_INET6;
+		net.addr[0] = src[0];
+		net.addr[1] = src[1] &
+			      bpf_htonl(~0U << (64 - BL_BLOOM_PREFIX_V6));
+	} else {
+		return XDP_PASS;
+	}
+
+	if (bpf_map_peek_elem(&bl_bloom, &net)) {
+		st->bloom_miss++;
+		return XDP_PASS;
+	}
+	st->bloom_hit++;
+
+	if (net.family == AF_INET) {
+		key4.prefixlen = 32;
+		__builtin_memcpy(key4.addr, src, sizeof(key4.addr));
+		hit = bpf_map_lookup_elem(&bl_v4, &key4);
+	} else {
+		key6.prefixlen = 128;
+		__builtin_memcpy(key6.addr, src, sizeof(key6.addr));
+		hit = bpf_map_lookup_elem(&bl_v6, &key6);
+	}
+	if (!hit)
+		return XDP_PASS;
 
-	bpf_printk("XDP: received ICMPv6 packet! Drop it!");
+	st->blocked++;
+	xdp_event_packet(ctx, pkt, XDP_DROP);
 	return XDP_DROP;
 }
 
 SEC("xdp")
-int  xdp_prog_drop_icmpv6(struct xdp_md *ctx)
+int  xdp_prog_blocklist(struct xdp_md *ctx)
 {
 	void *data_end = (void *)(long)ctx->data_end;
 	void *data = (void *)(long)ctx->data;
+	struct packet_info pkt;
 	struct hdr_cursor nh;
-	struct ethhdr *eth;
-	int h_proto;
-       __u16 proto;
+	__u32 action = XDP_PASS;
 
-	/* These keep track of the next header type and interator pointer */
 	nh.pos = data;
 
-	h_proto = parse_ethhdr(&nh, data_end, &eth);
-	if (h_proto < 0)
-		/* we cannot parse the ethernet header; instead of droppig the
-		 * packet we allow it to go in the kernel networking stack to
-		 * be further processed.
-		 */
+	if (parse_packet(&nh, data_end, &pkt) < 0)
 		goto out;
 
-	/* From network-byte-order to machine endianess */
-	proto = bpf_ntohs(h_proto);
-	switch (proto) {
-	case ETH_P_IPV6:
-		return process_ipv6hdr(&nh, data_end);
+	action = bl_check(ctx, &pkt);
+out:
+	return xdp_stats_record_action(ctx, action);
+}
+
+/* TCP header of the SYN-ACKs sent by xdp_prog_syncookie: the fixed part
+ * and a single MSS option. SYNs with a shorter header are left to the stack.
+ */
+#define SYNCOOKIE_TCP_LEN	24
+#define SYNCOOKIE_WINDOW	65535
+#define TCPOPT_MSS		2
+#define TCPOLEN_MSS		4
+
+static __always_inline __u16 csum_fold(__u32 csum)
+{
+	csum = (csum & 0xFFFF) + (csum >> 16);
+	csum = (csum & 0xFFFF) + (csum >> 16);
+	return (__u16)~csum;
+}
+
+/* Sum of the TCP pseudo-header of a SYNCOOKIE_TCP_LEN segment */
+static __always_inline __u32 tcp_pseudo_csum_v4(const struct iphdr *iph)
+{
+	struct {
+		__be32 saddr;
+		__be32 daddr;
+		__u8 zero;
+		__u8 proto;
+		__be16 len;
+	} ph = {
+		.saddr = iph->saddr,
+		.daddr = iph->daddr,
+		.proto = IPPROTO_TCP,
+		.len = bpf_htons(SYNCOOKIE_TCP_LEN),
 	};
 
-	/* Pass the packet to the upper kernel networking */
-out:
+	return bpf_csum_diff(NULL, 0, (__be32 *)&ph, sizeof(ph), 0);
+}
+
+static __always_inline __u32 tcp_pseudo_csum_v6(const struct ipv6hdr *ip6h)
+{
+	struct {
+		struct in6_addr saddr;
+		struct in6_addr daddr;
+		__be32 len;
+		__u8 zero[3];
+		__u8 nexthdr;
+	} ph = {
+		.saddr = ip6h->saddr,
+		.daddr = ip6h->daddr,
+		.len = bpf_htonl(SYNCOOKIE_TCP_LEN),
+		.nexthdr = IPPROTO_TCP,
+	};
+
+	return bpf_csum_diff(NULL, 0, (__be32 *)&ph, sizeof(ph), 0);
+}
+
+/* Find the IP and TCP headers of @pkt again, as pointers the verifier can
+ * follow. Only IPv4 without options and IPv6 without extension headers are
+ * handled, which is what the SYNs of a flood and of any common client look
+ * like; anything else goes to the stack untouched.
+ */
+static __always_inline struct tcphdr *
+syncookie_headers(struct xdp_md *ctx, const struct packet_info *pkt,
+		  struct iphdr **iph, struct ipv6hdr **ip6h)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	__u32 off = pkt->l3_off;
+	struct tcphdr *th;
+
+	*iph = NULL;
+	*ip6h = NULL;
+
+	/* Ethernet and at most VLAN_MAX_DEPTH tags */
+	if (off > sizeof(struct ethhdr) + VLAN_MAX_DEPTH * sizeof(struct vlan_hdr))
+		return NULL;
+
+	if (pkt->l3_proto == ETH_P_IP) {
+		*iph = data + off;
+		if ((void *)(*iph + 1) > data_end || (*iph)->ihl != 5)
+			return NULL;
+		th = (void *)(*iph + 1);
+	} else {
+		*ip6h = data + off;
+		if ((void *)(*ip6h + 1) > data_end ||
+		    (*ip6h)->nexthdr != IPPROTO_TCP)
+			return NULL;
+		th = (void *)(*ip6h + 1);
+	}
+
+	if ((void *)th + SYNCOOKIE_TCP_LEN > data_end)
+		return NULL;
+
+	return th;
+}
+
+/* Answer the SYN in place: swap the addresses and ports, and turn the TCP
+ * header into a SYN-ACK whose sequence number is the cookie and whose only
+ * option is the MSS encoded in it. The frame is trimmed right after.
+ */
+static __always_inline __u32
+syncookie_syn(struct xdp_md *ctx, const struct packet_info *pkt,
+	      struct syncookie_listener *lst, struct syncookie_stats *st)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	__u8 mac[ETH_ALEN], opts[60], *raw;
+	struct ethhdr *eth = data;
+	struct ipv6hdr *ip6h;
+	struct iphdr *iph;
+	struct tcphdr *th;
+	struct in6_addr addr6;
+	__u32 th_len, sum;
+	__be32 addr, seq;
+	__be16 port;
+	__s64 cookie;
+	__u64 now;
+	int delta;
+
+	/* Keep the kernel accepting the cookies of this listener */
+	now = bpf_ktime_get_ns();
+	if (now - lst->refresh_ns >= SYNCOOKIE_REFRESH_NS) {
+		lst->refresh_ns = now;
+		st->syn_passed++;
+		return XDP_PASS;
+	}
+
+	th = syncookie_headers(ctx, pkt, &iph, &ip6h);
+	if (!th || (void *)(eth + 1) > data_end)
+		return XDP_PASS;
+
+	/* The cookie helpers want the whole header, options included */
+	th_len = th->doff * 4;
+	if (th_len < SYNCOOKIE_TCP_LEN ||
+	    bpf_xdp_load_bytes(ctx, (void *)th - data, opts, th_len))
+		return XDP_PASS;
+
+	if (iph)
+		cookie = bpf_tcp_raw_gen_syncookie_ipv4(iph, (void *)opts,
+							th_len);
+	else
+		cookie = bpf_tcp_raw_gen_syncookie_ipv6(ip6h, (void *)opts,
+							th_len);
+	if (cookie < 0)
+		return XDP_PASS;
+
+	__builtin_memcpy(mac, eth->h_dest, sizeof(mac));
+	__builtin_memcpy(eth->h_dest, eth->h_source, sizeof(mac));
+	__builtin_memcpy(eth->h_source, mac, sizeof(mac));
+
+	if (iph) {
+		addr = iph->saddr;
+		iph->saddr = iph->daddr;
+		iph->daddr = addr;
+		iph->tot_len = bpf_htons(sizeof(*iph) + SYNCOOKIE_TCP_LEN);
+		iph->id = 0;
+		iph->frag_off = bpf_htons(IP_DF);
+		iph->ttl = 64;
+		iph->check = 0;
+		iph->check = csum_fold(bpf_csum_diff(NULL, 0, (__be32 *)iph,
+						     sizeof(*iph), 0));
+		sum = tcp_pseudo_csum_v4(iph);
+	} else {
+		addr6 = ip6h->saddr;
+		ip6h->saddr = ip6h->daddr;
+		ip6h->daddr = addr6;
+		ip6h->payload_len = bpf_htons(SYNCOOKIE_TCP_LEN);
+		ip6h->hop_limit = 64;
+		sum = tcp_pseudo_csum_v6(ip6h);
+	}
+
+	seq = th->seq;
+	port = th->source;
+	th->source = th->dest;
+	th->dest = port;
+	th->seq = bpf_htonl((__u32)cookie);
+	th->ack_seq = bpf_htonl(bpf_ntohl(seq) + 1);
+	raw = (__u8 *)th;
+	raw[12] = (SYNCOOKIE_TCP_LEN / 4) << 4;
+	raw[13] = TCP_FLAG_SYN | TCP_FLAG_ACK;
+	th->window = bpf_htons(SYNCOOKIE_WINDOW);
+	th->check = 0;
+	th->urg_ptr = 0;
+	raw[20] = TCPOPT_MSS;
+	raw[21] = TCPOLEN_MSS;
+	raw[22] = (cookie >> 40) & 0xFF;
+	raw[23] = (cookie >> 32) & 0xFF;
+	th->check = csum_fold(bpf_csum_diff(NULL, 0, (__be32 *)th,
+					    SYNCOOKIE_TCP_LEN, sum));
+
+	/* Drop the options and payload of the SYN past the new header */
+	delta = (int)((void *)th + SYNCOOKIE_TCP_LEN - data_end);
+	if (delta && bpf_xdp_adjust_tail(ctx, delta))
+		return XDP_DROP;
+
+	st->syn_cookies++;
+	return XDP_TX;
+}
+
+/* An ACK towards a listener either belongs to a socket the stack knows
+ * about, established or still in its own handshake, or completes one of
+ * our handshakes and carries a valid cookie. Anything else is a flood.
+ */
+static __always_inline __u32
+syncookie_ack(struct xdp_md *ctx, const struct packet_info *pkt,
+	      struct syncookie_stats *st)
+{
+	struct bpf_sock_tuple tuple = {};
+	struct ipv6hdr *ip6h;
+	struct bpf_sock *sk;
+	struct iphdr *iph;
+	struct tcphdr *th;
+	__u32 tuple_len;
+	bool listening;
+	long err;
+
+	th = syncookie_headers(ctx, pkt, &iph, &ip6h);
+	if (!th)
+		return XDP_PASS;
+
+	if (iph) {
+		tuple.ipv4.saddr = iph->saddr;
+		tuple.ipv4.daddr = iph->daddr;
+		tuple.ipv4.sport = th->source;
+		tuple.ipv4.dport = th->dest;
+		tuple_len = sizeof(tuple.ipv4);
+	} else {
+		__builtin_memcpy(tuple.ipv6.saddr, &ip6h->saddr,
+				 sizeof(tuple.ipv6.saddr));
+		__builtin_memcpy(tuple.ipv6.daddr, &ip6h->daddr,
+				 sizeof(tuple.ipv6.daddr));
+		tuple.ipv6.sport = th->source;
+		tuple.ipv6.dport = th->dest;
+		tuple_len = sizeof(tuple.ipv6);
+	}
+
+	sk = bpf_skc_lookup_tcp(ctx, &tuple, tuple_len, BPF_F_CURRENT_NETNS, 0);
+	/* Nobody listening: the stack answers with a RST */
+	if (!sk)
+		return XDP_PASS;
+	listening = sk->state == BPF_TCP_LISTEN;
+	bpf_sk_release(sk);
+	if (!listening)
+		return XDP_PASS;
+
+	if (iph)
+		err = bpf_tcp_raw_check_syncookie_ipv4(iph, th);
+	else
+		err = bpf_tcp_raw_check_syncookie_ipv6(ip6h, th);
+	if (err) {
+		st->ack_invalid++;
+		xdp_event_packet(ctx, pkt, XDP_DROP);
+		return XDP_DROP;
+	}
+
+	st->ack_valid++;
 	return XDP_PASS;
 }
 
+static __always_inline __u32
+syncookie_handle(struct xdp_md *ctx, const struct packet_info *pkt)
+{
+	struct syncookie_listener *lst;
+	struct syncookie_stats *st;
+	__u16 port;
+	__u32 key = 0;
+	__u8 flags;
+
+	if (pkt->l4_proto != IPPROTO_TCP || !pkt->l4_off)
+		return XDP_PASS;
+
+	port = bpf_ntohs(pkt->dport);
+	lst = bpf_map_lookup_elem(&syncookie_listeners, &port);
+	st = bpf_map_lookup_elem(&syncookie_stats, &key);
+	if (!lst || !st)
+		return XDP_PASS;
+
+	flags = pkt->tcp_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_FLAG_RST);
+	if (flags == TCP_FLAG_SYN)
+		return syncookie_syn(ctx, pkt, lst, st);
+	if (flags == TCP_FLAG_ACK)
+		return syncookie_ack(ctx, pkt, st);
+
+	return XDP_PASS;
+}
+
+SEC("xdp")
+int  xdp_prog_syncookie(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct packet_info pkt;
+	struct hdr_cursor nh;
+	__u32 action = XDP_PASS;
+
+	nh.pos = data;
+
+	if (parse_packet(&nh, data_end, &pkt) < 0)
+		goto out;
+
+	action = syncookie_handle(ctx, &pkt);
+out:
+	return xdp_stats_record_action(ctx, action);
+}
+
+/* Parse the headers once into xdp_scratch and run the chain of stages in
+ * xdp_stages. The verdict is accounted by the stage that takes it, or here
+ * when the packet cannot be parsed or the chain is empty.
+ */
+SEC("xdp")
+int  xdp_prog_dispatcher(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct xdp_scratch *scratch;
+	struct hdr_cursor nh;
+	__u32 key = 0;
+
+	scratch = bpf_map_lookup_elem(&xdp_scratch, &key);
+	if (!scratch)
+		return xdp_stats_record_action(ctx, XDP_ABORTED);
+
+	nh.pos = data;
+
+	/* Unparsable and non-IP traffic is left to the kernel stack */
+	if (parse_packet(&nh, data_end, &scratch->pkt) < 0)
+		return xdp_stats_record_action(ctx, XDP_PASS);
+
+	scratch->stage = 0;
+	bpf_tail_call(ctx, &xdp_stages, 0);
+
+	return xdp_stats_record_action(ctx, XDP_PASS);
+}
+
+/* Finish a stage: XDP_PASS hands the packet to the next stage, or to the
+ * stack past the end of the chain; XDP_ACCEPT hands it to the stack right
+ * away, and any other verdict is final too.
+ */
+static __always_inline int
+xdp_stage_done(struct xdp_md *ctx, struct xdp_scratch *scratch, __u32 action)
+{
+	if (action == XDP_ACCEPT)
+		return xdp_stats_record_action(ctx, XDP_PASS);
+	if (action != XDP_PASS)
+		return xdp_stats_record_action(ctx, action);
+
+	bpf_tail_call(ctx, &xdp_stages, ++scratch->stage);
+	return xdp_stats_record_action(ctx, XDP_PASS);
+}
+
+static __always_inline struct xdp_scratch *xdp_stage_scratch(void)
+{
+	__u32 key = 0;
+
+	return bpf_map_lookup_elem(&xdp_scratch, &key);
+}
+
+/* The stages, run by xdp_prog_dispatcher only: the same filters as the
+ * programs above, working on the headers that the dispatcher parsed.
+ */
+SEC("xdp")
+int  xdp_stage_blocklist(struct xdp_md *ctx)
+{
+	struct xdp_scratch *scratch = xdp_stage_scratch();
+
+	if (!scratch)
+		return xdp_stats_record_action(ctx, XDP_ABORTED);
+
+	return xdp_stage_done(ctx, scratch, bl_check(ctx, &scratch->pkt));
+}
+
+SEC("xdp")
+int  xdp_stage_icmpv6(struct xdp_md *ctx)
+{
+	struct xdp_scratch *scratch = xdp_stage_scratch();
+	__u32 action = XDP_PASS;
+
+	if (!scratch)
+		return xdp_stats_record_action(ctx, XDP_ABORTED);
+
+	if (scratch->pkt.l3_proto == ETH_P_IPV6)
+		action = process_ipv6hdr(ctx, &scratch->pkt);
+
+	return xdp_stage_done(ctx, scratch, action);
+}
+
+SEC("xdp")
+int  xdp_stage_acl(struct xdp_md *ctx)
+{
+	struct xdp_scratch *scratch = xdp_stage_scratch();
+
+	if (!scratch)
+		return xdp_stats_record_action(ctx, XDP_ABORTED);
+
+	return xdp_stage_done(ctx, scratch, acl_classify(ctx, &scratch->pkt));
+}
+
+SEC("xdp")
+int  xdp_stage_ratelimit(struct xdp_md *ctx)
+{
+	struct xdp_scratch *scratch = xdp_stage_scratch();
+
+	if (!scratch)
+		return xdp_stats_record_action(ctx, XDP_ABORTED);
+
+	return xdp_stage_done(ctx, scratch, rl_limit(ctx, &scratch->pkt));
+}
+
+SEC("xdp")
+int  xdp_stage_syncookie(struct xdp_md *ctx)
+{
+	struct xdp_scratch *scratch = xdp_stage_scratch();
+
+	if (!scratch)
+		return xdp_stats_record_action(ctx, XDP_ABORTED);
+
+	return xdp_stage_done(ctx, scratch,
+			      syncookie_handle(ctx, &scratch->pkt));
+}
+
+SEC("xdp")
+int  xdp_stage_xsk(struct xdp_md *ctx)
+{
+	struct xdp_scratch *scratch = xdp_stage_scratch();
+
+	if (!scratch)
+		return xdp_stats_record_action(ctx, XDP_ABORTED);
+
+	return xdp_stage_done(ctx, scratch, xsk_steer(ctx, &scratch->pkt));
+}
+
+/* RFC 1624 incremental update: the TTL is the high byte of a 16-bit word,
+ * so decrementing it adds 0x0100 to the one's complement checksum.
+ */
+static __always_inline int ip_decrease_ttl(struct iphdr *iph)
+{
+	__u32 check = (__u32)iph->check;
+
+	check += (__u32)bpf_htons(0x0100);
+	iph->check = (__sum16)(check + (check >= 0xFFFF));
+	return --iph->ttl;
+}
+
+/* Forward the frame at @data as the kernel would: route it with
+ * bpf_fib_lookup(), decrement the TTL or hop limit, rewrite the MAC
+ * addresses and send it out through xdp_tx_ports. Anything that needs the
+ * stack (expiring TTL, no neighbour entry yet, local delivery, egress port
+ * not in the devmap) is passed up instead, so that the kernel can answer
+ * with ICMP or resolve the neighbour.
+ */
+SEC("xdp")
+int  xdp_prog_router(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct bpf_fib_lookup fib = {};
+	struct ipv6hdr *ip6h = NULL;
+	struct iphdr *iph = NULL;
+	struct hdr_cursor nh;
+	struct ethhdr *eth;
+	__u32 action = XDP_PASS;
+	int proto, rc;
+
+	nh.pos = data;
+
+	proto = parse_ethhdr(&nh, data_end, &eth);
+	/* Tagged frames would need the VLAN device of the egress port */
+	if (proto < 0 || nh.pos != data + sizeof(*eth))
+		goto out;
+
+	if (proto == bpf_htons(ETH_P_IP)) {
+		if (parse_iphdr(&nh, data_end, &iph) < 0 || iph->ttl <= 1)
+			goto out;
+
+		fib.family = AF_INET;
+		fib.tos = iph->tos;
+		fib.l4_protocol = iph->protocol;
+		fib.tot_len = bpf_ntohs(iph->tot_len);
+		fib.ipv4_src = iph->saddr;
+		fib.ipv4_dst = iph->daddr;
+	} else if (proto == bpf_htons(ETH_P_IPV6)) {
+		if (parse_ip6hdr(&nh, data_end, &ip6h) < 0 ||
+		    ip6h->hop_limit <= 1)
+			goto out;
+
+		fib.family = AF_INET6;
+		fib.flowinfo = *(__be32 *)ip6h & bpf_htonl(0x0FFFFFFF);
+		fib.l4_protocol = ip6h->nexthdr;
+		fib.tot_len = bpf_ntohs(ip6h->payload_len);
+		__builtin_memcpy(fib.ipv6_src, &ip6h->saddr, sizeof(fib.ipv6_src));
+		__builtin_memcpy(fib.ipv6_dst, &ip6h->daddr, sizeof(fib.ipv6_dst));
+	} else {
+		goto out;
+	}
+
+	fib.ifindex = ctx->ingress_ifindex;
+
+	rc = bpf_fib_lookup(ctx, &fib, sizeof(fib), 0);
+	if (rc != BPF_FIB_LKUP_RET_SUCCESS)
+		goto out;
+
+	/* Not one of our ports: let the stack forward it */
+	if (!bpf_map_lookup_elem(&xdp_tx_ports, &fib.ifindex))
+		goto out;
+
+	if (iph)
+		ip_decrease_ttl(iph);
+	else if (ip6h)
+		ip6h->hop_limit--;
+
+	__builtin_memcpy(eth->h_dest, fib.dmac, sizeof(eth->h_dest));
+	__builtin_memcpy(eth->h_source, fib.smac, sizeof(eth->h_source));
+
+	action = bpf_redirect_map(&xdp_tx_ports, fib.ifindex, 0);
+out:
+	return xdp_stats_record_action(ctx, action);
+}
+
 char _license[] SEC("license") = "Dual BSD/GPL";
@@ -0,0 +1,829 @@
+// SPDX-License-Identifier: GPL-2.0
+/* netprog loader: open, load and attach netprog.bpf.o through its skeleton,
+ * pin the maps under /sys/fs/bpf/netprog and print live statistics.
+ *
+ *   netprog -i veth1 [-i veth2 ...]   load, attach and print pps/bps
+ *   netprog -q -i veth1               load, attach and exit
+ *   netprog -U -i veth1               detach
+ *   netprog -p xdp_prog_router -i veth1 -i veth2
+ *                                     forward between veth1 and veth2
+ *   netprog -q -p xdp_prog_xsk -i veth1
+ *                                     steer the pings to an AF_XDP socket,
+ *                                     see xdp_xsk
+ *   netprog -c acl,icmpv6 -i veth1    run the ACL, then the ICMPv6 filter
+ *   netprog -r prio=0,action=drop,proto=icmpv6
+ *                                     add an xdp_prog_acl rule
+ *   netprog -l                        list the rules and their hits
+ *   netprog -L class=icmp,rate=100,burst=20
+ *                                     limit ICMP to 100 pps per source
+ *   netprog -t                        list the rate limits and their hits
+ *   netprog -k 80                     answer the SYNs to port 80 with
+ *                                     cookies from xdp_prog_syncookie
+ *   netprog -y                        list the cookie ports and counters
+ *   netprog -b blocklist.txt          drop the sources listed in the file
+ *                                     with xdp_prog_blocklist
+ *   netprog -B                        print the blocklist size and counters
+ *
+ * Programs are attached through bpf_links pinned under
+ * /sys/fs/bpf/netprog/links, so they stay attached after the loader exits.
+ * Running netprog again on the same interfaces is a redeploy: the new
+ * program replaces the old one atomically behind the existing link, and the
+ * pinned maps are reused so that xdp_stats, xdp_events and the counters
+ * themselves carry on across the upgrade.
+ *
+ * Only one XDP program can be attached to an interface; -c attaches
+ * xdp_prog_dispatcher instead, which parses the headers once and tail-calls
+ * the given stages (xdp_stage_<name>) in order through the xdp_stages
+ * program array. A stage that passes the packet hands it on to the next
+ * one, any other verdict ends the chain; so does an ACL pass rule, which
+ * sends the packet to the stack without running the stages after the ACL.
+ * Put acl first to exempt traffic from the other filters. The array is
+ * pinned with the other maps, so a new -c on a running interface changes
+ * the chain in place.
+ *
+ * The rules of xdp_prog_acl are kept in those pinned maps too: -r, -R and -l
+ * work on them directly, with or without -i, and take effect on the running
+ * program right away. So do the rate limits of xdp_prog_ratelimit, set with
+ * -L and listed with -t, and the SYN cookie ports of xdp_prog_syncookie, set
+ * with -k and -K and listed with -y, and the blocklist of xdp_prog_blocklist,
+ * loaded in bulk with -b and summarised with -B.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <net/if.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+#include "netprog.skel.h"
+
+#define MAX_IFACES 16
+
+struct config {
+	int ifindex[MAX_IFACES];
+	const char *ifname[MAX_IFACES];
+	int nr_ifaces;
+	const char *prog_name;
+	char *stage[XDP_CHAIN_MAX];
+	int nr_stages;
+	__u32 xdp_mode;		/* 0: native with fallback to generic */
+	__u32 sample_rate;
+	bool set_sample_rate;
+	bool quiet;
+	bool unload;
+	char *rule_add[ACL_MAX_RULES];
+	int nr_rule_add;
+	__u32 rule_del[ACL_MAX_RULES];
+	int nr_rule_del;
+	bool list_rules;
+	char *limit[RL_CLASS_MAX];
+	int nr_limits;
+	bool list_limits;
+	__u16 cookie_add[SYNCOOKIE_MAX_LISTENERS];
+	int nr_cookie_add;
+	__u16 cookie_del[SYNCOOKIE_MAX_LISTENERS];
+	int nr_cookie_del;
+	bool list_cookies;
+	const char *blocklist;
+	bool list_blocklist;
+};
+
+static volatile sig_atomic_t exiting;
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+static const struct option long_options[] = {
+	{ "dev",		required_argument,	NULL, 'i' },
+	{ "prog",		required_argument,	NULL, 'p' },
+	{ "chain",		required_argument,	NULL, 'c' },
+	{ "native-mode",	no_argument,		NULL, 'N' },
+	{ "skb-mode",		no_argument,		NULL, 'S' },
+	{ "sample-rate",	required_argument,	NULL, 's' },
+	{ "quiet",		no_argument,		NULL, 'q' },
+	{ "unload",		no_argument,		NULL, 'U' },
+	{ "rule",		required_argument,	NULL, 'r' },
+	{ "rule-del",		required_argument,	NULL, 'R' },
+	{ "list-rules",		no_argument,		NULL, 'l' },
+	{ "limit",		required_argument,	NULL, 'L' },
+	{ "list-limits",	no_argument,		NULL, 't' },
+	{ "syncookie",		required_argument,	NULL, 'k' },
+	{ "syncookie-del",	required_argument,	NULL, 'K' },
+	{ "list-syncookies",	no_argument,		NULL, 'y' },
+	{ "blocklist",		required_argument,	NULL, 'b' },
+	{ "list-blocklist",	no_argument,		NULL, 'B' },
+	{ "help",		no_argument,		NULL, 'h' },
+	{ 0, 0, NULL, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS] -i IFNAME [-i IFNAME ...]\n"
+		"       %s [-r RULE ...] [-R PRIO ...] [-l] [-L LIMIT ...] [-t]\n"
+		"          [-k PORT ...] [-K PORT ...] [-y] [-b FILE] [-B]\n"
+		"  -i, --dev IFNAME       interface to attach to (up to %d)\n"
+		"  -p, --prog NAME        XDP program (default xdp_prog_drop_icmpv6)\n"
+		"  -c, --chain STAGE,...  attach xdp_prog_dispatcher running these\n"
+		"                         stages in order: acl, blocklist, icmpv6,\n"
+		"                         ratelimit, syncookie, xsk (up to %d)\n"
+		"  -N, --native-mode      native/driver mode only, no fallback\n"
+		"  -S, --skb-mode         generic (skb) mode only\n"
+		"  -s, --sample-rate N    report one packet every N to xdp_events\n"
+		"  -q, --quiet            exit after attaching, no statistics\n"
+		"  -U, --unload           detach from the interfaces\n"
+		"  -r, --rule RULE        add or replace an xdp_prog_acl rule:\n"
+		"                         prio=N,action=pass|drop|redirect|count\n"
+		"                         [,src=PREFIX][,dst=PREFIX][,proto=P]\n"
+		"                         [,dport=N][,dev=IFNAME]\n"
+		"  -R, --rule-del PRIO    delete the rule with priority PRIO\n"
+		"  -l, --list-rules       print the rules and their hit counters\n"
+		"  -L, --limit LIMIT      set an xdp_prog_ratelimit class:\n"
+		"                         class=icmp|udp|syn|other,rate=PPS\n"
+		"                         [,burst=N][,v4=LEN][,v6=LEN]\n"
+		"  -t, --list-limits      print the rate limits and their counters\n"
+		"  -k, --syncookie PORT   answer the SYNs to TCP port PORT with\n"
+		"                         xdp_prog_syncookie\n"
+		"  -K, --syncookie-del PORT\n"
+		"                         stop answering the SYNs to PORT\n"
+		"  -y, --list-syncookies  print the SYN cookie ports and counters\n"
+		"  -b, --blocklist FILE   add the addresses and prefixes in FILE,\n"
+		"                         one per line, to xdp_prog_blocklist\n"
+		"  -B, --list-blocklist   print the blocklist size and counters\n",
+		prog, prog, MAX_IFACES, XDP_CHAIN_MAX);
+}
+
+static int parse_port(const char *str, __u16 *port)
+{
+	unsigned long val;
+	char *end;
+
+	val = strtoul(str, &end, 10);
+	if (*end || !val || val > USHRT_MAX)
+		return -EINVAL;
+
+	*port = val;
+	return 0;
+}
+
+static bool has_rule_ops(const struct config *cfg)
+{
+	return cfg->nr_rule_add || cfg->nr_rule_del || cfg->list_rules ||
+	       cfg->nr_limits || cfg->list_limits || cfg->nr_cookie_add ||
+	       cfg->nr_cookie_del || cfg->list_cookies || cfg->blocklist ||
+	       cfg->list_blocklist;
+}
+
+static int parse_args(int argc, char **argv, struct config *cfg)
+{
+	char *stage;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "i:p:c:NSs:qUr:R:lL:tk:K:yb:Bh",
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			if (cfg->nr_ifaces == MAX_IFACES) {
+				fprintf(stderr, "ERR: too many interfaces\n");
+				return -EINVAL;
+			}
+			cfg->ifindex[cfg->nr_ifaces] = if_nametoindex(optarg);
+			if (!cfg->ifindex[cfg->nr_ifaces]) {
+				fprintf(stderr, "ERR: unknown interface %s\n",
+					optarg);
+				return -EINVAL;
+			}
+			cfg->ifname[cfg->nr_ifaces++] = optarg;
+			break;
+		case 'p':
+			cfg->prog_name = optarg;
+			break;
+		case 'c':
+			cfg->nr_stages = 0;
+			while ((stage = strsep(&optarg, ","))) {
+				if (cfg->nr_stages == XDP_CHAIN_MAX) {
+					fprintf(stderr, "ERR: too many stages\n");
+					return -EINVAL;
+				}
+				cfg->stage[cfg->nr_stages++] = stage;
+			}
+			cfg->prog_name = "xdp_prog_dispatcher";
+			break;
+		case 'N':
+			cfg->xdp_mode = XDP_FLAGS_DRV_MODE;
+			break;
+		case 'S':
+			cfg->xdp_mode = XDP_FLAGS_SKB_MODE;
+			break;
+		case 's':
+			cfg->sample_rate = strtoul(optarg, NULL, 0);
+			cfg->set_sample_rate = true;
+			break;
+		case 'q':
+			cfg->quiet = true;
+			break;
+		case 'U':
+			cfg->unload = true;
+			break;
+		case 'r':
+			if (cfg->nr_rule_add == ACL_MAX_RULES)
+				return -EINVAL;
+			cfg->rule_add[cfg->nr_rule_add++] = optarg;
+			break;
+		case 'R':
+			if (cfg->nr_rule_del == ACL_MAX_RULES)
+				return -EINVAL;
+			cfg->rule_del[cfg->nr_rule_del++] = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			cfg->list_rules = true;
+			break;
+		case 'L':
+			if (cfg->nr_limits == RL_CLASS_MAX)
+				return -EINVAL;
+			cfg->limit[cfg->nr_limits++] = optarg;
+			break;
+		case 't':
+			cfg->list_limits = true;
+			break;
+		case 'k':
+			if (cfg->nr_cookie_add == SYNCOOKIE_MAX_LISTENERS ||
+			    parse_port(optarg, &cfg->cookie_add[cfg->nr_cookie_add]))
+				return -EINVAL;
+			cfg->nr_cookie_add++;
+			break;
+		case 'K':
+			if (cfg->nr_cookie_del == SYNCOOKIE_MAX_LISTENERS ||
+			    parse_port(optarg, &cfg->cookie_del[cfg->nr_cookie_del]))
+				return -EINVAL;
+			cfg->nr_cookie_del++;
+			break;
+		case 'y':
+			cfg->list_cookies = true;
+			break;
+		case 'b':
+			cfg->blocklist = optarg;
+			break;
+		case 'B':
+			cfg->list_blocklist = true;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (!cfg->nr_ifaces && !has_rule_ops(cfg))
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Apply the -R, -r, -L, -K, -k and -b options, in this order, then print
+ * the rules, the limits, the SYN cookie ports and the blocklist if -l, -t,
+ * -y and -B were given. Needs the maps pinned by a previous or the current
+ * load.
+ */
+static int rule_ops(const struct config *cfg)
+{
+	struct rl_class_cfg limit;
+	struct acl_rule rule;
+	__u32 slot, class;
+	int i, err;
+
+	for (i = 0; i < cfg->nr_rule_del; i++) {
+		err = acl_rule_del(cfg->rule_del[i]);
+		if (err) {
+			fprintf(stderr, "ERR: deleting rule %u: %s\n",
+				cfg->rule_del[i], strerror(-err));
+			return err;
+		}
+	}
+
+	for (i = 0; i < cfg->nr_rule_add; i++) {
+		err = acl_rule_parse(cfg->rule_add[i], &slot, &rule);
+		if (err) {
+			fprintf(stderr, "ERR: invalid rule %s\n",
+				cfg->rule_add[i]);
+			return err;
+		}
+
+		err = acl_rule_set(slot, &rule);
+		if (err) {
+			fprintf(stderr, "ERR: installing rule %s: %s\n",
+				cfg->rule_add[i], strerror(-err));
+			return err;
+		}
+	}
+
+	for (i = 0; i < cfg->nr_limits; i++) {
+		err = rl_class_parse(cfg->limit[i], &class, &limit);
+		if (err) {
+			fprintf(stderr, "ERR: invalid limit %s\n",
+				cfg->limit[i]);
+			return err;
+		}
+
+		err = rl_class_set(class, &limit);
+		if (err) {
+			fprintf(stderr, "ERR: installing limit %s: %s\n",
+				cfg->limit[i], strerror(-err));
+			return err;
+		}
+	}
+
+	for (i = 0; i < cfg->nr_cookie_del; i++) {
+		err = syncookie_listener_del(cfg->cookie_del[i]);
+		if (err) {
+			fprintf(stderr, "ERR: deleting SYN cookie port %u: %s\n",
+				cfg->cookie_del[i], strerror(-err));
+			return err;
+		}
+	}
+
+	for (i = 0; i < cfg->nr_cookie_add; i++) {
+		err = syncookie_listener_add(cfg->cookie_add[i]);
+		if (err) {
+			fprintf(stderr, "ERR: adding SYN cookie port %u: %s\n",
+				cfg->cookie_add[i], strerror(-err));
+			return err;
+		}
+	}
+
+	if (cfg->blocklist) {
+		err = bl_load(cfg->blocklist);
+		if (err) {
+			fprintf(stderr, "ERR: loading the blocklist %s: %s\n",
+				cfg->blocklist, strerror(-err));
+			return err;
+		}
+	}
+
+	if (cfg->list_rules) {
+		err = acl_rules_print();
+		if (err) {
+			fprintf(stderr, "ERR: reading the rules: %s\n",
+				strerror(-err));
+			return err;
+		}
+	}
+
+	if (cfg->list_limits) {
+		err = rl_classes_print();
+		if (err) {
+			fprintf(stderr, "ERR: reading the limits: %s\n",
+				strerror(-err));
+			return err;
+		}
+	}
+
+	if (cfg->list_cookies) {
+		err = syncookie_print();
+		if (err) {
+			fprintf(stderr, "ERR: reading the SYN cookie ports: %s\n",
+				strerror(-err));
+			return err;
+		}
+	}
+
+	if (cfg->list_blocklist) {
+		err = bl_print();
+		if (err) {
+			fprintf(stderr, "ERR: reading the blocklist: %s\n",
+				strerror(-err));
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/* Pin every map, but .rodata, under NETPROG_MAPS_DIR. When a compatible map
+ * is already pinned there libbpf reuses it instead of creating a new one, so
+ * the counters survive a reload. bpffs does not allow dots in file names.
+ */
+static int set_pin_paths(struct bpf_object *obj)
+{
+	char path[PATH_MAX], *p;
+	struct bpf_map *map;
+	int err;
+
+	if (mkdir(NETPROG_PIN_DIR, 0700) && errno != EEXIST)
+		return -errno;
+	if (mkdir(NETPROG_MAPS_DIR, 0700) && errno != EEXIST)
+		return -errno;
+	if (mkdir(NETPROG_LINKS_DIR, 0700) && errno != EEXIST)
+		return -errno;
+
+	bpf_object__for_each_map(map, obj) {
+		const char *name = bpf_map__name(map);
+
+		if (strstr(name, ".rodata"))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", NETPROG_MAPS_DIR, name);
+		for (p = path + strlen(NETPROG_MAPS_DIR); *p; p++)
+			if (*p == '.')
+				*p = '_';
+
+		err = bpf_map__set_pin_path(map, path);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static const char *xdp_mode2str(__u32 mode)
+{
+	return mode == XDP_FLAGS_SKB_MODE ? "generic" : "native";
+}
+
+/* An XDP link being deployed on one interface, with what is needed to roll
+ * the interface back if another one fails.
+ */
+struct xdp_link {
+	int fd;
+	int old_prog_fd;	/* program swapped out by this run, or -1 */
+	bool created;		/* link created and pinned by this run */
+};
+
+static void link_pin_path(char *buf, size_t size, const char *ifname)
+{
+	snprintf(buf, size, "%s/%s", NETPROG_LINKS_DIR, ifname);
+}
+
+/* Create the link in the requested mode; with no mode requested try native
+ * first and fall back to generic for drivers without XDP support.
+ */
+static int xdp_link_create(int ifindex, int prog_fd, __u32 mode, __u32 *used)
+{
+	LIBBPF_OPTS(bpf_link_create_opts, opts);
+	int fd;
+
+	*used = mode ? mode : XDP_FLAGS_DRV_MODE;
+	opts.flags = *used;
+	fd = bpf_link_create(prog_fd, ifindex, BPF_XDP, &opts);
+	if (fd >= 0 || mode)
+		return fd;
+
+	*used = XDP_FLAGS_SKB_MODE;
+	opts.flags = *used;
+	return bpf_link_create(prog_fd, ifindex, BPF_XDP, &opts);
+}
+
+/* Attach @prog_fd to @ifname through a bpf_link pinned in NETPROG_LINKS_DIR.
+ * When the link is already pinned, i.e. netprog is being redeployed, the
+ * program behind it is swapped with bpf_link_update(): the kernel replaces
+ * the pointer atomically, so no packet ever sees the interface without a
+ * program, and the reused pinned maps keep counting across the upgrade.
+ */
+static int xdp_link_deploy(const char *ifname, int ifindex, int prog_fd,
+			   __u32 mode, struct xdp_link *link)
+{
+	LIBBPF_OPTS(bpf_link_update_opts, opts);
+	struct bpf_link_info info;
+	__u32 len = sizeof(info);
+	char path[PATH_MAX];
+	__u32 used;
+	int err;
+
+	link->old_prog_fd = -1;
+	link->created = false;
+	link_pin_path(path, sizeof(path), ifname);
+
+	link->fd = bpf_obj_get(path);
+	if (link->fd >= 0) {
+		memset(&info, 0, sizeof(info));
+		if (!bpf_link_get_info_by_fd(link->fd, &info, &len))
+			link->old_prog_fd = bpf_prog_get_fd_by_id(info.prog_id);
+
+		/* Fail instead of clobbering a concurrent redeploy */
+		if (link->old_prog_fd >= 0) {
+			opts.flags = BPF_F_REPLACE;
+			opts.old_prog_fd = link->old_prog_fd;
+		}
+
+		err = bpf_link_update(link->fd, prog_fd, &opts);
+		if (err)
+			return err;
+
+		printf("%s: program replaced on %s\n", ifname, path);
+		return 0;
+	}
+	if (errno != ENOENT)
+		return -errno;
+
+	link->fd = xdp_link_create(ifindex, prog_fd, mode, &used);
+	if (link->fd < 0)
+		return link->fd;
+
+	err = bpf_obj_pin(link->fd, path);
+	if (err) {
+		close(link->fd);
+		link->fd = -1;
+		return err;
+	}
+	link->created = true;
+
+	printf("%s: attached in %s mode, link pinned on %s\n", ifname,
+	       xdp_mode2str(used), path);
+	return 0;
+}
+
+static void xdp_link_rollback(const char *ifname, struct xdp_link *link)
+{
+	char path[PATH_MAX];
+
+	if (link->created) {
+		link_pin_path(path, sizeof(path), ifname);
+		unlink(path);
+	} else if (link->old_prog_fd >= 0) {
+		bpf_link_update(link->fd, link->old_prog_fd, NULL);
+	}
+}
+
+static void xdp_link_close(struct xdp_link *link)
+{
+	if (link->old_prog_fd >= 0)
+		close(link->old_prog_fd);
+	if (link->fd >= 0)
+		close(link->fd);
+}
+
+/* Programs attached through netlink, e.g. by "bpftool net attach" */
+static int xdp_detach_legacy(int ifindex)
+{
+	LIBBPF_OPTS(bpf_xdp_query_opts, opts);
+	__u32 mode;
+	int err;
+
+	err = bpf_xdp_query(ifindex, 0, &opts);
+	if (err)
+		return err;
+
+	switch (opts.attach_mode) {
+	case XDP_ATTACHED_NONE:
+		return 0;
+	case XDP_ATTACHED_SKB:
+		mode = XDP_FLAGS_SKB_MODE;
+		break;
+	case XDP_ATTACHED_DRV:
+		mode = XDP_FLAGS_DRV_MODE;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	return bpf_xdp_detach(ifindex, mode, NULL);
+}
+
+/* Removing the pin drops the last reference to the link, which detaches the
+ * program; the maps stay pinned for the next deploy.
+ */
+static int unload(const struct config *cfg)
+{
+	char path[PATH_MAX];
+	int i, err, ret = 0;
+
+	for (i = 0; i < cfg->nr_ifaces; i++) {
+		link_pin_path(path, sizeof(path), cfg->ifname[i]);
+		if (!unlink(path))
+			continue;
+
+		err = errno == ENOENT ? xdp_detach_legacy(cfg->ifindex[i])
+				      : -errno;
+		if (err) {
+			fprintf(stderr, "ERR: detaching from %s: %s\n",
+				cfg->ifname[i], strerror(-err));
+			ret = err;
+		}
+	}
+
+	return ret;
+}
+
+/* Make the interfaces valid egress ports for xdp_prog_router. Entries are
+ * only added, so that a run on a subset of the ports does not stop the
+ * forwarding towards the others.
+ */
+static int tx_ports_add(int map_fd, const struct config *cfg)
+{
+	__u32 ifindex;
+	int i;
+
+	for (i = 0; i < cfg->nr_ifaces; i++) {
+		ifindex = cfg->ifindex[i];
+		if (ifindex >= XDP_TX_PORTS_MAX) {
+			fprintf(stderr, "ERR: %s: ifindex %u beyond the %d "
+				"slots of xdp_tx_ports\n", cfg->ifname[i],
+				ifindex, XDP_TX_PORTS_MAX);
+			return -E2BIG;
+		}
+
+		if (bpf_map_update_elem(map_fd, &ifindex, &ifindex, BPF_ANY))
+			return -errno;
+	}
+
+	return 0;
+}
+
+/* Fill xdp_stages with the -c stages, in order, and empty the slots past
+ * them. Every stage is resolved before the first slot is written, so a bad
+ * name leaves a running chain untouched; the stale slots are only cleared
+ * once the new chain is in place. Each slot switches to its new stage
+ * atomically, but a packet may see some slots already updated and some not.
+ */
+static int chain_set(struct bpf_object *obj, int map_fd,
+		     const struct config *cfg)
+{
+	struct bpf_program *prog;
+	int fd[XDP_CHAIN_MAX];
+	char name[64];
+	__u32 i;
+
+	for (i = 0; i < cfg->nr_stages; i++) {
+		snprintf(name, sizeof(name), "xdp_stage_%s", cfg->stage[i]);
+		prog = bpf_object__find_program_by_name(obj, name);
+		if (!prog) {
+			fprintf(stderr, "ERR: no stage named %s\n",
+				cfg->stage[i]);
+			return -ENOENT;
+		}
+
+		fd[i] = bpf_program__fd(prog);
+		if (fd[i] < 0) {
+			fprintf(stderr, "ERR: stage %s is not loaded\n",
+				cfg->stage[i]);
+			return fd[i];
+		}
+	}
+
+	for (i = 0; i < cfg->nr_stages; i++) {
+		if (bpf_map_update_elem(map_fd, &i, &fd[i], BPF_ANY))
+			return -errno;
+	}
+
+	for (; i < XDP_CHAIN_MAX; i++) {
+		if (bpf_map_delete_elem(map_fd, &i) && errno != ENOENT)
+			return -errno;
+	}
+
+	return 0;
+}
+
+static int stats_loop(int map_fd)
+{
+	struct stats_record rec, prev;
+	int err;
+
+	err = stats_collect(map_fd, &prev);
+	if (err)
+		return err;
+
+	while (!exiting) {
+		sleep(1);
+
+		err = stats_collect(map_fd, &rec);
+		if (err)
+			return err;
+
+		stats_print(&rec, &prev);
+		printf("\n");
+		fflush(stdout);
+		prev = rec;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct config cfg = {
+		.prog_name = "xdp_prog_drop_icmpv6",
+	};
+	struct xdp_link links[MAX_IFACES];
+	struct bpf_program *prog;
+	struct netprog_bpf *skel;
+	int i, prog_fd, err;
+
+	if (parse_args(argc, argv, &cfg)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (cfg.unload)
+		return unload(&cfg) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	/* Rule, limit and cookie changes alone go to the pinned maps, no reload */
+	if (!cfg.nr_ifaces)
+		return rule_ops(&cfg) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	skel = netprog_bpf__open();
+	if (!skel) {
+		fprintf(stderr, "ERR: cannot open BPF skeleton\n");
+		return EXIT_FAILURE;
+	}
+
+	err = set_pin_paths(skel->obj);
+	if (err) {
+		fprintf(stderr, "ERR: cannot prepare %s: %s\n",
+			NETPROG_MAPS_DIR, strerror(-err));
+		goto out;
+	}
+
+	err = netprog_bpf__load(skel);
+	if (err) {
+		fprintf(stderr, "ERR: cannot load BPF object: %s\n",
+			strerror(-err));
+		if (err == -EINVAL)
+			fprintf(stderr, "ERR: if a map definition changed, "
+				"remove the stale pins in %s\n",
+				NETPROG_MAPS_DIR);
+		goto out;
+	}
+
+	/* .bss is memory mapped, also when reused from a previous run */
+	if (cfg.set_sample_rate)
+		skel->bss->event_sample_rate = cfg.sample_rate;
+
+	prog = bpf_object__find_program_by_name(skel->obj, cfg.prog_name);
+	if (!prog) {
+		fprintf(stderr, "ERR: no program named %s\n", cfg.prog_name);
+		err = -ENOENT;
+		goto out;
+	}
+	prog_fd = bpf_program__fd(prog);
+
+	err = tx_ports_add(bpf_map__fd(skel->maps.xdp_tx_ports), &cfg);
+	if (err) {
+		fprintf(stderr, "ERR: cannot fill xdp_tx_ports: %s\n",
+			strerror(-err));
+		goto out;
+	}
+
+	if (cfg.nr_stages) {
+		err = chain_set(skel->obj, bpf_map__fd(skel->maps.xdp_stages),
+				&cfg);
+		if (err) {
+			fprintf(stderr, "ERR: cannot set up the chain: %s\n",
+				strerror(-err));
+			goto out;
+		}
+	}
+
+	/* Install the rules before the program sees any traffic */
+	if (has_rule_ops(&cfg)) {
+		err = rule_ops(&cfg);
+		if (err)
+			goto out;
+	}
+
+	for (i = 0; i < cfg.nr_ifaces; i++) {
+		err = xdp_link_deploy(cfg.ifname[i], cfg.ifindex[i], prog_fd,
+				      cfg.xdp_mode, &links[i]);
+		if (err) {
+			fprintf(stderr, "ERR: attaching %s to %s: %s\n",
+				cfg.prog_name, cfg.ifname[i], strerror(-err));
+			if (err == -EBUSY)
+				fprintf(stderr, "ERR: another program is attached, "
+					"remove it with -U first\n");
+			/* Leave no interface half configured */
+			xdp_link_close(&links[i]);
+			while (i--) {
+				xdp_link_rollback(cfg.ifname[i], &links[i]);
+				xdp_link_close(&links[i]);
+			}
+			goto out;
+		}
+	}
+
+	/* The pins keep the links alive once we exit */
+	for (i = 0; i < cfg.nr_ifaces; i++)
+		xdp_link_close(&links[i]);
+
+	if (cfg.quiet)
+		goto out;
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	err = stats_loop(bpf_map__fd(skel->maps.xdp_stats_map));
+	if (err)
+		fprintf(stderr, "ERR: reading statistics: %s\n",
+			strerror(-err));
+
+out:
+	netprog_bpf__destroy(skel);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,450 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Packet header parsers shared by every XDP program in this directory.
+ *
+ * Each parse_*() helper takes the header cursor, checks the bytes it is
+ * about to read against data_end with __may_pull(), moves the cursor past
+ * the header and returns the next protocol (or a length for L4), or -EINVAL
+ * when the packet is truncated or malformed. They are all __always_inline and
+ * every loop has a constant bound, so the verifier sees plain straight-line
+ * bounds checks. New filters should build on parse_packet(), or on the
+ * single-header helpers, instead of re-deriving the checks.
+ */
+#ifndef __PARSING_HELPERS_H
+#define __PARSING_HELPERS_H
+
+#include <vmlinux.h>
+#include <errno.h>
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+/* Not part of the BTF in vmlinux.h, these are preprocessor constants */
+#define ETH_ALEN		6	/* Ethernet address length */
+
+#define ETH_P_IP		0x0800	/* IPv4 */
+#define ETH_P_IPV6		0x86DD	/* IPv6 */
+#define ETH_P_8021Q		0x8100	/* 802.1Q VLAN */
+#define ETH_P_8021AD		0x88A8	/* 802.1ad QinQ outer tag */
+
+#define IPPROTO_HOPOPTS		0	/* IPv6 hop-by-hop options */
+#define IPPROTO_ROUTING		43	/* IPv6 routing header */
+#define IPPROTO_FRAGMENT	44	/* IPv6 fragmentation header */
+#define IPPROTO_ICMPV6		58	/* ICMPv6 */
+#define IPPROTO_NONE		59	/* IPv6 no next header */
+#define IPPROTO_DSTOPTS		60	/* IPv6 destination options */
+#define IPPROTO_MH		135	/* IPv6 mobility header */
+
+#define ICMPV6_ECHO_REQUEST	128
+#define ICMPV6_ECHO_REPLY	129
+
+#define IP_DF			0x4000	/* IPv4 don't fragment flag */
+#define IP_MF			0x2000	/* IPv4 more fragments flag */
+#define IP_OFFSET		0x1FFF	/* IPv4 fragment offset mask */
+#define IP6_OFFSET		0xFFF8	/* IPv6 fragment offset mask */
+
+#define AF_INET			2
+#define AF_INET6		10
+
+/* Maximum number of VLAN tags (802.1Q + 802.1ad) */
+#define VLAN_MAX_DEPTH		2
+/* Maximum number of IPv6 extension headers walked before giving up */
+#define IPV6_EXT_MAX_CHAIN	6
+
+/* Byte-count bounds check; check if current pointer at @start + @off of header
+ * is after @end.
+ */
+#define __may_pull(start, off, end) \
+	(((unsigned char *)(start)) + (off) <= ((unsigned char *)(end)))
+
+/* Header cursor to keep track of current parsing position */
+struct hdr_cursor {
+	void *pos;
+};
+
+union ip_addr {
+	__be32 v4;
+	struct in6_addr v6;
+};
+
+/* Everything parse_packet() learnt about a packet. Offsets are relative to
+ * the start of the frame; addresses and ports are in network byte order.
+ */
+struct packet_info {
+	__u16 l3_proto;			/* ETH_P_IP or ETH_P_IPV6 */
+	__u16 l3_off;
+	__u16 l4_off;			/* 0 when there is no L4 header */
+	__u8 l4_proto;
+	__u8 frag;			/* non-first fragment, no L4 header */
+	__u16 vlan_id[VLAN_MAX_DEPTH];	/* outermost first, 0 if untagged */
+	union ip_addr saddr;
+	union ip_addr daddr;
+	__be16 sport;			/* TCP and UDP only */
+	__be16 dport;
+	__u8 icmp_type;			/* ICMP and ICMPv6 only */
+	__u8 icmp_code;
+	__u8 tcp_flags;			/* TCP only, see TCP_FLAG_* */
+	__u8 ttl;			/* TTL or hop limit */
+};
+
+/* TCP flags as found in the 14th byte of the TCP header */
+#define TCP_FLAG_FIN		0x01
+#define TCP_FLAG_SYN		0x02
+#define TCP_FLAG_RST		0x04
+#define TCP_FLAG_PSH		0x08
+#define TCP_FLAG_ACK		0x10
+
+static __always_inline int proto_is_vlan(__u16 h_proto)
+{
+	return !!(h_proto == bpf_htons(ETH_P_8021Q) ||
+		  h_proto == bpf_htons(ETH_P_8021AD));
+}
+
+/* Parse the Ethernet header and up to VLAN_MAX_DEPTH VLAN tags behind it;
+ * the tag IDs are stored in @vlan_id when given. Returns the inner
+ * EtherType in network byte order.
+ */
+static __always_inline int
+parse_ethhdr_vlan(struct hdr_cursor *nh, void *data_end, struct ethhdr **ethhdr,
+		  __u16 *vlan_id)
+{
+	struct ethhdr *eth = nh->pos;
+	int hdrsize = sizeof(*eth);
+	struct vlan_hdr *vlh;
+	__u16 h_proto;
+	int i;
+
+	if (!__may_pull(eth, hdrsize, data_end))
+		return -EINVAL;
+
+	/* Move the cursor ahead as we have parsed the ethernet header */
+	nh->pos += hdrsize;
+	/* network-byte-order */
+	h_proto = eth->h_proto;
+
+	if (ethhdr)
+		*ethhdr = eth;
+
+	vlh = nh->pos;
+
+	/* Use loop unrolling to avoid the verifier restriction on loops;
+	 * support up to VLAN_MAX_DEPTH layers of VLAN encapsulation.
+	 */
+#pragma unroll
+	for (i = 0; i < VLAN_MAX_DEPTH; i++) {
+		if (!proto_is_vlan(h_proto))
+			break;
+
+		if (!__may_pull(vlh, sizeof(*vlh), data_end))
+			return -EINVAL;
+
+		h_proto = vlh->h_vlan_encapsulated_proto;
+		if (vlan_id)
+			vlan_id[i] = bpf_ntohs(vlh->h_vlan_TCI) & 0x0fff;
+		vlh++;
+	}
+
+	nh->pos = vlh;
+	return h_proto;
+}
+
+static __always_inline int
+parse_ethhdr(struct hdr_cursor *nh, void *data_end, struct ethhdr **ethhdr)
+{
+	return parse_ethhdr_vlan(nh, data_end, ethhdr, NULL);
+}
+
+/* Parse the IPv4 header including its options. Returns the L4 protocol. */
+static __always_inline int
+parse_iphdr(struct hdr_cursor *nh, void *data_end, struct iphdr **iphdr)
+{
+	struct iphdr *iph = nh->pos;
+	int hdrsize;
+
+	if (!__may_pull(iph, sizeof(*iph), data_end))
+		return -EINVAL;
+
+	if (iph->version != 4)
+		return -EINVAL;
+
+	hdrsize = iph->ihl * 4;
+	/* Sanity check packet field is valid */
+	if (hdrsize < sizeof(*iph))
+		return -EINVAL;
+
+	/* Variable-length IPv4 header, need to use byte-based arithmetic */
+	if (!__may_pull(iph, hdrsize, data_end))
+		return -EINVAL;
+
+	nh->pos += hdrsize;
+
+	if (iphdr)
+		*iphdr = iph;
+
+	return iph->protocol;
+}
+
+/* True for every fragment but the first one: no L4 header to look at */
+static __always_inline int ip_is_later_fragment(const struct iphdr *iph)
+{
+	return !!(iph->frag_off & bpf_htons(IP_OFFSET));
+}
+
+static __always_inline int
+parse_ip6hdr(struct hdr_cursor *nh, void *data_end, struct ipv6hdr **ip6hdr)
+{
+	struct ipv6hdr *ip6h = nh->pos;
+	int hdrsize = sizeof(*ip6h);
+
+	/* Pointer-arithmetic bounds check; pointer +1 points to after end of
+	 * thing being pointed to.
+	 */
+	if (!__may_pull(ip6h, hdrsize, data_end))
+		return -EINVAL;
+
+	if (ip6h->version != 6)
+		return -EINVAL;
+
+	nh->pos += hdrsize;
+
+	if (ip6hdr)
+		*ip6hdr = ip6h;
+
+	return ip6h->nexthdr;
+}
+
+/* Walk at most IPV6_EXT_MAX_CHAIN extension headers starting from
+ * @nexthdr. The fragment header, if any, is returned in @fraghdr. Returns the
+ * upper layer protocol, with the cursor on its header.
+ */
+static __always_inline int
+skip_ip6hdrext(struct hdr_cursor *nh, void *data_end, __u8 nexthdr,
+	       struct frag_hdr **fraghdr)
+{
+	int i;
+
+#pragma unroll
+	for (i = 0; i < IPV6_EXT_MAX_CHAIN; i++) {
+		struct ipv6_opt_hdr *hdr = nh->pos;
+
+		switch (nexthdr) {
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_DSTOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_MH:
+			if (!__may_pull(hdr, sizeof(*hdr), data_end))
+				return -EINVAL;
+
+			nh->pos = (char *)hdr + (hdr->hdrlen + 1) * 8;
+			nexthdr = hdr->nexthdr;
+			break;
+		case IPPROTO_AH:
+			if (!__may_pull(hdr, sizeof(*hdr), data_end))
+				return -EINVAL;
+
+			nh->pos = (char *)hdr + (hdr->hdrlen + 2) * 4;
+			nexthdr = hdr->nexthdr;
+			break;
+		case IPPROTO_FRAGMENT:
+			if (!__may_pull(hdr, sizeof(struct frag_hdr), data_end))
+				return -EINVAL;
+
+			if (fraghdr)
+				*fraghdr = (struct frag_hdr *)hdr;
+			nh->pos = (char *)hdr + sizeof(struct frag_hdr);
+			nexthdr = hdr->nexthdr;
+			break;
+		default:
+			/* Upper layer protocol, or IPPROTO_NONE */
+			return nexthdr;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/* Returns the TCP header length, options included */
+static __always_inline int
+parse_tcphdr(struct hdr_cursor *nh, void *data_end, struct tcphdr **tcphdr)
+{
+	struct tcphdr *h = nh->pos;
+	int len;
+
+	if (!__may_pull(h, sizeof(*h), data_end))
+		return -EINVAL;
+
+	len = h->doff * 4;
+	/* Sanity check packet field is valid */
+	if (len < sizeof(*h))
+		return -EINVAL;
+
+	/* Variable-length TCP header, need to use byte-based arithmetic */
+	if (!__may_pull(h, len, data_end))
+		return -EINVAL;
+
+	nh->pos += len;
+
+	if (tcphdr)
+		*tcphdr = h;
+
+	return len;
+}
+
+/* Returns the UDP payload length as announced by the header */
+static __always_inline int
+parse_udphdr(struct hdr_cursor *nh, void *data_end, struct udphdr **udphdr)
+{
+	struct udphdr *h = nh->pos;
+	int len;
+
+	if (!__may_pull(h, sizeof(*h), data_end))
+		return -EINVAL;
+
+	len = bpf_ntohs(h->len) - sizeof(*h);
+	if (len < 0)
+		return -EINVAL;
+
+	nh->pos += sizeof(*h);
+
+	if (udphdr)
+		*udphdr = h;
+
+	return len;
+}
+
+/* Returns the ICMP type */
+static __always_inline int
+parse_icmphdr(struct hdr_cursor *nh, void *data_end, struct icmphdr **icmphdr)
+{
+	struct icmphdr *icmph = nh->pos;
+
+	if (!__may_pull(icmph, sizeof(*icmph), data_end))
+		return -EINVAL;
+
+	nh->pos += sizeof(*icmph);
+
+	if (icmphdr)
+		*icmphdr = icmph;
+
+	return icmph->type;
+}
+
+/* Returns the ICMPv6 type */
+static __always_inline int
+parse_icmp6hdr(struct hdr_cursor *nh, void *data_end,
+	       struct icmp6hdr **icmp6hdr)
+{
+	struct icmp6hdr *icmp6h = nh->pos;
+
+	if (!__may_pull(icmp6h, sizeof(*icmp6h), data_end))
+		return -EINVAL;
+
+	nh->pos += sizeof(*icmp6h);
+
+	if (icmp6hdr)
+		*icmp6hdr = icmp6h;
+
+	return icmp6h->icmp6_type;
+}
+
+/* Parse the L4 header at the cursor into @pkt */
+static __always_inline int
+parse_l4(struct hdr_cursor *nh, void *data_end, struct packet_info *pkt)
+{
+	struct icmp6hdr *icmp6h;
+	struct icmphdr *icmph;
+	struct tcphdr *tcph;
+	struct udphdr *udph;
+
+	switch (pkt->l4_proto) {
+	case IPPROTO_TCP:
+		if (parse_tcphdr(nh, data_end, &tcph) < 0)
+			return -EINVAL;
+		pkt->sport = tcph->source;
+		pkt->dport = tcph->dest;
+		pkt->tcp_flags = ((__u8 *)tcph)[13];
+		break;
+	case IPPROTO_UDP:
+		if (parse_udphdr(nh, data_end, &udph) < 0)
+			return -EINVAL;
+		pkt->sport = udph->source;
+		pkt->dport = udph->dest;
+		break;
+	case IPPROTO_ICMP:
+		if (parse_icmphdr(nh, data_end, &icmph) < 0)
+			return -EINVAL;
+		pkt->icmp_type = icmph->type;
+		pkt->icmp_code = icmph->code;
+		break;
+	case IPPROTO_ICMPV6:
+		if (parse_icmp6hdr(nh, data_end, &icmp6h) < 0)
+			return -EINVAL;
+		pkt->icmp_type = icmp6h->icmp6_type;
+		pkt->icmp_code = icmp6h->icmp6_code;
+		break;
+	}
+
+	return 0;
+}
+
+/* Parse Ethernet (with VLAN tags), IPv4 or IPv6 (with extension headers) and
+ * the TCP, UDP or ICMP header of the frame at the cursor, which is left on
+ * the L4 payload. Returns 0 on success, -EINVAL for truncated or malformed
+ * packets and -EPROTONOSUPPORT for L3 protocols other than IPv4/IPv6.
+ */
+static __always_inline int
+parse_packet(struct hdr_cursor *nh, void *data_end, struct packet_info *pkt)
+{
+	void *data = nh->pos;
+	struct frag_hdr *fragh = NULL;
+	struct ipv6hdr *ip6h;
+	struct iphdr *iph;
+	int proto;
+
+	__builtin_memset(pkt, 0, sizeof(*pkt));
+
+	proto = parse_ethhdr_vlan(nh, data_end, NULL, pkt->vlan_id);
+	if (proto < 0)
+		return -EINVAL;
+
+	pkt->l3_proto = bpf_ntohs(proto);
+	pkt->l3_off = nh->pos - data;
+
+	switch (pkt->l3_proto) {
+	case ETH_P_IP:
+		proto = parse_iphdr(nh, data_end, &iph);
+		if (proto < 0)
+			return -EINVAL;
+
+		pkt->saddr.v4 = iph->saddr;
+		pkt->daddr.v4 = iph->daddr;
+		pkt->ttl = iph->ttl;
+		pkt->frag = ip_is_later_fragment(iph);
+		break;
+	case ETH_P_IPV6:
+		proto = parse_ip6hdr(nh, data_end, &ip6h);
+		if (proto < 0)
+			return -EINVAL;
+
+		pkt->saddr.v6 = ip6h->saddr;
+		pkt->daddr.v6 = ip6h->daddr;
+		pkt->ttl = ip6h->hop_limit;
+
+		proto = skip_ip6hdrext(nh, data_end, proto, &fragh);
+		if (proto < 0)
+			return -EINVAL;
+
+		if (fragh)
+			pkt->frag = !!(fragh->frag_off & bpf_htons(IP6_OFFSET));
+		break;
+	default:
+		return -EPROTONOSUPPORT;
+	}
+
+	pkt->l4_proto = proto;
+	if (pkt->frag)
+		return 0;
+
+	pkt->l4_off = nh->pos - data;
+	return parse_l4(nh, data_end, pkt);
+}
+
+#endif /* __PARSING_HELPERS_H */
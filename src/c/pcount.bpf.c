@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* BPF port of kernel/modules/packet_counter.c: the same TCP, UDP and
+ * per-port counting, done by a BPF_PROG_TYPE_NETFILTER program that pcount
+ * attaches through one netfilter bpf_link per family and hook. Nothing has
+ * to be built against the running kernel and there is no insmod.
+ *
+ * The skb is read through a dynptr: bpf_dynptr_slice() returns a pointer
+ * into the linear area when the bytes are there and copies them out of the
+ * page fragments otherwise, as skb_header_pointer() does in the module.
+ * Offsets are relative to skb->data, i.e. to the network header at every
+ * hook pcount attaches to.
+ */
+#include <vmlinux.h>
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#include "common.h"
+#include "parsing_helpers.h"
+
+/* Netfilter verdicts, preprocessor constants as well */
+#define NF_ACCEPT		1
+
+extern int bpf_dynptr_from_skb(struct __sk_buff *skb, __u64 flags,
+			       struct bpf_dynptr *ptr__uninit) __ksym;
+extern void *bpf_dynptr_slice(const struct bpf_dynptr *ptr, __u32 offset,
+			      void *buffer, __u32 buffer__szk) __ksym;
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, struct pcount_stats);
+	__uint(max_entries, PCOUNT_NR_HOOKS);
+} pcount_stats SEC(".maps");
+
+/* Received packets by destination port, as port_packets in the module:
+ * packets without a port are counted on port 0
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__type(key, __u32);
+	__type(value, __u64);
+	__uint(max_entries, PCOUNT_NR_PORTS);
+} pcount_ports SEC(".maps");
+
+/* L4 protocol and offset of its header, -1 for non-first fragments and
+ * truncated headers (*proto stays 0 for the latter), like pc_transport()
+ */
+static __always_inline int transport(const struct bpf_dynptr *ptr, __u8 pf,
+				     __u8 *proto)
+{
+	struct ipv6_opt_hdr _opt, *opt;
+	struct ipv6hdr _ip6h, *ip6h;
+	struct iphdr _iph, *iph;
+	struct frag_hdr _fh, *fh;
+	__u8 nexthdr;
+	int off, i;
+
+	*proto = 0;
+
+	if (pf == NFPROTO_IPV4) {
+		iph = bpf_dynptr_slice(ptr, 0, &_iph, sizeof(_iph));
+		if (!iph || iph->ihl < 5)
+			return -1;
+
+		*proto = iph->protocol;
+		if (iph->frag_off & bpf_htons(IP_OFFSET))
+			return -1;
+		return iph->ihl * 4;
+	}
+
+	ip6h = bpf_dynptr_slice(ptr, 0, &_ip6h, sizeof(_ip6h));
+	if (!ip6h)
+		return -1;
+
+	nexthdr = ip6h->nexthdr;
+	off = sizeof(*ip6h);
+
+#pragma unroll
+	for (i = 0; i < IPV6_EXT_MAX_CHAIN; i++) {
+		switch (nexthdr) {
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_DSTOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_MH:
+			opt = bpf_dynptr_slice(ptr, off, &_opt, sizeof(_opt));
+			if (!opt)
+				return -1;
+			off += (opt->hdrlen + 1) * 8;
+			nexthdr = opt->nexthdr;
+			break;
+		case IPPROTO_AH:
+			opt = bpf_dynptr_slice(ptr, off, &_opt, sizeof(_opt));
+			if (!opt)
+				return -1;
+			off += (opt->hdrlen + 2) * 4;
+			nexthdr = opt->nexthdr;
+			break;
+		case IPPROTO_FRAGMENT:
+			fh = bpf_dynptr_slice(ptr, off, &_fh, sizeof(_fh));
+			if (!fh)
+				return -1;
+			*proto = fh->nexthdr;
+			if (fh->frag_off & bpf_htons(IP6_OFFSET))
+				return -1;
+			off += sizeof(*fh);
+			nexthdr = fh->nexthdr;
+			break;
+		default:
+			*proto = nexthdr;
+			return off;
+		}
+	}
+
+	return -1;
+}
+
+SEC("netfilter")
+int pcount(struct bpf_nf_ctx *ctx)
+{
+	const struct nf_hook_state *state = ctx->state;
+	struct pcount_stats *stats;
+	struct bpf_dynptr ptr;
+	__u32 idx, port = 0;
+	__be16 _ports[2], *ports;
+	__u64 *count;
+	__u8 proto;
+	int thoff;
+
+	/* IPv4 hooks first, then IPv6, in NF_INET_* order */
+	idx = state->hook + (state->pf == NFPROTO_IPV6 ? PCOUNT_NR_HOOKS / 2 : 0);
+	stats = bpf_map_lookup_elem(&pcount_stats, &idx);
+	if (!stats)
+		return NF_ACCEPT;
+
+	if (bpf_dynptr_from_skb((struct __sk_buff *)ctx->skb, 0, &ptr))
+		return NF_ACCEPT;
+
+	thoff = transport(&ptr, state->pf, &proto);
+	if (proto == IPPROTO_TCP || proto == IPPROTO_UDP) {
+		if (proto == IPPROTO_TCP)
+			stats->tcp++;
+		else
+			stats->udp++;
+
+		if (thoff >= 0) {
+			ports = bpf_dynptr_slice(&ptr, thoff, _ports,
+						 sizeof(_ports));
+			if (ports)
+				port = bpf_ntohs(ports[1]);
+		}
+	}
+	stats->total++;
+
+	if (state->hook == NF_INET_PRE_ROUTING) {
+		count = bpf_map_lookup_elem(&pcount_ports, &port);
+		if (count)
+			(*count)++;
+	}
+
+	return NF_ACCEPT;
+}
+
+char _license[] SEC("license") = "GPL";
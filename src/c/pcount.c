@@ -0,0 +1,416 @@
+// SPDX-License-Identifier: GPL-2.0
+/* pcount loader: attach pcount.bpf.o, the BPF port of packet_counter, to
+ * the IPv4 and IPv6 netfilter hooks of the current network namespace and
+ * print its counters.
+ *
+ *   pcount                 attach and print the received pps every second
+ *   pcount -q              attach and exit, the links stay pinned
+ *   pcount -o              print the counters, like /proc/net/packet_counter
+ *   pcount -U              detach
+ *
+ * There is one netfilter bpf_link per family and hook, pinned under
+ * /sys/fs/bpf/pcount/links. A netfilter link cannot swap its program, so
+ * a new version is deployed with -U first. Like the module, the program
+ * only sees the namespace it was attached from: run pcount with
+ * "ip netns exec".
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/netfilter.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+#include "pcount.skel.h"
+
+/* The kernel rejects NF_IP_PRI_FIRST (INT_MIN) for bpf_links: run right
+ * after it, ahead of conntrack and every table, as the module does
+ */
+#define PCOUNT_PRIORITY		(INT_MIN + 1)
+
+#define PCOUNT_PORTS_BATCH	4096
+
+static const struct {
+	const char *name;
+	__u32 pf;
+	__u32 hooknum;
+} hooks[PCOUNT_NR_HOOKS] = {
+	{ "ipv4_prerouting",	NFPROTO_IPV4, NF_INET_PRE_ROUTING },
+	{ "ipv4_input",		NFPROTO_IPV4, NF_INET_LOCAL_IN },
+	{ "ipv4_forward",	NFPROTO_IPV4, NF_INET_FORWARD },
+	{ "ipv4_output",	NFPROTO_IPV4, NF_INET_LOCAL_OUT },
+	{ "ipv6_prerouting",	NFPROTO_IPV6, NF_INET_PRE_ROUTING },
+	{ "ipv6_input",		NFPROTO_IPV6, NF_INET_LOCAL_IN },
+	{ "ipv6_forward",	NFPROTO_IPV6, NF_INET_FORWARD },
+	{ "ipv6_output",	NFPROTO_IPV6, NF_INET_LOCAL_OUT },
+};
+
+struct config {
+	int priority;
+	bool quiet;
+	bool once;
+	bool unload;
+};
+
+static volatile sig_atomic_t exiting;
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+static const struct option long_options[] = {
+	{ "priority",	required_argument,	NULL, 'P' },
+	{ "quiet",	no_argument,		NULL, 'q' },
+	{ "once",	no_argument,		NULL, 'o' },
+	{ "unload",	no_argument,		NULL, 'U' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ 0, 0, NULL, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-P PRIO] [-q] | -o | -U\n"
+		"  -P, --priority PRIO    netfilter hook priority (default %d)\n"
+		"  -q, --quiet            exit after attaching, no statistics\n"
+		"  -o, --once             print the counters and exit\n"
+		"  -U, --unload           detach from the hooks\n",
+		prog, PCOUNT_PRIORITY);
+}
+
+static int parse_args(int argc, char **argv, struct config *cfg)
+{
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "P:qoUh", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'P':
+			cfg->priority = strtol(optarg, NULL, 0);
+			break;
+		case 'q':
+			cfg->quiet = true;
+			break;
+		case 'o':
+			cfg->once = true;
+			break;
+		case 'U':
+			cfg->unload = true;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void link_pin_path(char *buf, size_t size, int hook)
+{
+	snprintf(buf, size, "%s/%s", PCOUNT_LINKS_DIR, hooks[hook].name);
+}
+
+static int set_pin_paths(struct bpf_object *obj)
+{
+	char path[PATH_MAX];
+	struct bpf_map *map;
+	int err;
+
+	if (mkdir(PCOUNT_PIN_DIR, 0700) && errno != EEXIST)
+		return -errno;
+	if (mkdir(PCOUNT_MAPS_DIR, 0700) && errno != EEXIST)
+		return -errno;
+	if (mkdir(PCOUNT_LINKS_DIR, 0700) && errno != EEXIST)
+		return -errno;
+
+	bpf_object__for_each_map(map, obj) {
+		snprintf(path, sizeof(path), "%s/%s", PCOUNT_MAPS_DIR,
+			 bpf_map__name(map));
+		err = bpf_map__set_pin_path(map, path);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/* Attach to every hook and pin the links; on failure none stays attached */
+static int attach(struct pcount_bpf *skel, const struct config *cfg)
+{
+	LIBBPF_OPTS(bpf_netfilter_opts, opts);
+	struct bpf_link *links[PCOUNT_NR_HOOKS] = {};
+	char path[PATH_MAX];
+	int i, err = 0;
+
+	for (i = 0; i < PCOUNT_NR_HOOKS; i++) {
+		opts.pf = hooks[i].pf;
+		opts.hooknum = hooks[i].hooknum;
+		opts.priority = cfg->priority;
+
+		links[i] = bpf_program__attach_netfilter(skel->progs.pcount,
+							 &opts);
+		if (!links[i]) {
+			err = -errno;
+			fprintf(stderr, "ERR: attaching to %s: %s\n",
+				hooks[i].name, strerror(-err));
+			break;
+		}
+
+		link_pin_path(path, sizeof(path), i);
+		err = bpf_link__pin(links[i], path);
+		if (err) {
+			fprintf(stderr, "ERR: pinning %s: %s\n", path,
+				strerror(-err));
+			if (err == -EEXIST)
+				fprintf(stderr, "ERR: already attached, "
+					"remove it with -U first\n");
+			break;
+		}
+	}
+
+	/* The pins keep the links alive once we exit */
+	for (i = 0; i < PCOUNT_NR_HOOKS; i++) {
+		if (err && links[i])
+			bpf_link__unpin(links[i]);
+		bpf_link__destroy(links[i]);
+	}
+
+	if (!err)
+		printf("attached to %d hooks, links pinned in %s\n",
+		       PCOUNT_NR_HOOKS, PCOUNT_LINKS_DIR);
+	return err;
+}
+
+/* Removing the pins drops the last reference to the links */
+static int unload(void)
+{
+	char path[PATH_MAX];
+	int i, ret = 0;
+
+	for (i = 0; i < PCOUNT_NR_HOOKS; i++) {
+		link_pin_path(path, sizeof(path), i);
+		if (unlink(path) && errno != ENOENT) {
+			ret = -errno;
+			fprintf(stderr, "ERR: removing %s: %s\n", path,
+				strerror(-ret));
+		}
+	}
+
+	return ret;
+}
+
+/* Fold the per-CPU slots of pcount_stats */
+static int stats_read(int map_fd, struct pcount_stats *stats)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	__u32 key;
+	int i;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	struct pcount_stats values[nr_cpus];
+
+	memset(stats, 0, PCOUNT_NR_HOOKS * sizeof(*stats));
+	for (key = 0; key < PCOUNT_NR_HOOKS; key++) {
+		if (bpf_map_lookup_elem(map_fd, &key, values))
+			return -errno;
+
+		for (i = 0; i < nr_cpus; i++) {
+			stats[key].tcp += values[i].tcp;
+			stats[key].udp += values[i].udp;
+			stats[key].total += values[i].total;
+		}
+	}
+
+	return 0;
+}
+
+/* Print the ports with at least one packet, reading PCOUNT_PORTS_BATCH
+ * ports and all their CPUs with each syscall
+ */
+static int ports_print(int map_fd)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	__u32 keys[PCOUNT_PORTS_BATCH], count, i;
+	__u64 *values, sum;
+	__u32 batch = 0;
+	bool first = true;
+	int c, err = 0;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	values = calloc((size_t)PCOUNT_PORTS_BATCH * nr_cpus, sizeof(*values));
+	if (!values)
+		return -ENOMEM;
+
+	for (;;) {
+		count = PCOUNT_PORTS_BATCH;
+		err = bpf_map_lookup_batch(map_fd, first ? NULL : &batch,
+					   &batch, keys, values, &count, &opts);
+		if (err && errno != ENOENT) {
+			err = -errno;
+			break;
+		}
+		first = false;
+
+		for (i = 0; i < count; i++) {
+			for (c = 0, sum = 0; c < nr_cpus; c++)
+				sum += values[i * nr_cpus + c];
+			if (sum)
+				printf("Porta %u: %llu pacchetti\n", keys[i],
+				       (unsigned long long)sum);
+		}
+
+		/* ENOENT: that was the last batch */
+		if (err) {
+			err = 0;
+			break;
+		}
+	}
+
+	free(values);
+	return err;
+}
+
+static void stats_print(const struct pcount_stats *stats)
+{
+	int i;
+
+	printf("%-16s %12s %12s %12s\n", "hook", "tcp", "udp", "totale");
+	for (i = 0; i < PCOUNT_NR_HOOKS; i++)
+		printf("%-16s %12llu %12llu %12llu\n", hooks[i].name,
+		       (unsigned long long)stats[i].tcp,
+		       (unsigned long long)stats[i].udp,
+		       (unsigned long long)stats[i].total);
+}
+
+/* Received (PRE_ROUTING) packets per second, IPv4 and IPv6 together */
+static int stats_loop(int map_fd)
+{
+	struct pcount_stats cur[PCOUNT_NR_HOOKS], prev[PCOUNT_NR_HOOKS];
+	int v4 = 0, v6 = PCOUNT_NR_HOOKS / 2;
+	int err;
+
+	err = stats_read(map_fd, prev);
+	if (err)
+		return err;
+
+	while (!exiting) {
+		sleep(1);
+
+		err = stats_read(map_fd, cur);
+		if (err)
+			return err;
+
+		printf("tcp %10llu pps  udp %10llu pps  totale %10llu pps\n",
+		       (unsigned long long)(cur[v4].tcp + cur[v6].tcp -
+					    prev[v4].tcp - prev[v6].tcp),
+		       (unsigned long long)(cur[v4].udp + cur[v6].udp -
+					    prev[v4].udp - prev[v6].udp),
+		       (unsigned long long)(cur[v4].total + cur[v6].total -
+					    prev[v4].total - prev[v6].total));
+		fflush(stdout);
+		memcpy(prev, cur, sizeof(prev));
+	}
+
+	return 0;
+}
+
+static int print_once(void)
+{
+	struct pcount_stats stats[PCOUNT_NR_HOOKS];
+	char path[PATH_MAX];
+	int stats_fd, ports_fd, err;
+
+	snprintf(path, sizeof(path), "%s/pcount_stats", PCOUNT_MAPS_DIR);
+	stats_fd = open_pinned_path(path);
+	snprintf(path, sizeof(path), "%s/pcount_ports", PCOUNT_MAPS_DIR);
+	ports_fd = open_pinned_path(path);
+	if (stats_fd < 0 || ports_fd < 0) {
+		err = stats_fd < 0 ? stats_fd : ports_fd;
+		goto out;
+	}
+
+	err = stats_read(stats_fd, stats);
+	if (!err) {
+		stats_print(stats);
+		err = ports_print(ports_fd);
+	}
+	if (err)
+		fprintf(stderr, "ERR: reading the counters: %s\n",
+			strerror(-err));
+
+out:
+	if (stats_fd >= 0)
+		close(stats_fd);
+	if (ports_fd >= 0)
+		close(ports_fd);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	struct config cfg = {
+		.priority = PCOUNT_PRIORITY,
+	};
+	struct pcount_bpf *skel;
+	int err;
+
+	if (parse_args(argc, argv, &cfg)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (cfg.unload)
+		return unload() ? EXIT_FAILURE : EXIT_SUCCESS;
+	if (cfg.once)
+		return print_once() ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	skel = pcount_bpf__open();
+	if (!skel) {
+		fprintf(stderr, "ERR: cannot open BPF skeleton\n");
+		return EXIT_FAILURE;
+	}
+
+	err = set_pin_paths(skel->obj);
+	if (err) {
+		fprintf(stderr, "ERR: cannot prepare %s: %s\n",
+			PCOUNT_MAPS_DIR, strerror(-err));
+		goto out;
+	}
+
+	err = pcount_bpf__load(skel);
+	if (err) {
+		fprintf(stderr, "ERR: cannot load BPF object: %s\n",
+			strerror(-err));
+		goto out;
+	}
+
+	err = attach(skel, &cfg);
+	if (err || cfg.quiet)
+		goto out;
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	err = stats_loop(bpf_map__fd(skel->maps.pcount_stats));
+	if (err)
+		fprintf(stderr, "ERR: reading statistics: %s\n",
+			strerror(-err));
+
+out:
+	pcount_bpf__destroy(skel);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Userspace side of the xdp_prog_ratelimit token buckets.
+ *
+ * A class is configured by rewriting its slot of the pinned rl_classes
+ * array: the program picks up the new rate with the next packet, and the
+ * buckets already in rl_buckets are simply capped to the new depth as they
+ * refill. The fixed-point values the program needs (cost and depth of a
+ * bucket, in nanoseconds) are computed here, so that it never divides.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+
+#define NSEC_PER_SEC		1000000000ULL
+
+static const char *rl_class_names[RL_CLASS_MAX] = {
+	[RL_CLASS_ICMP]		= "icmp",
+	[RL_CLASS_UDP]		= "udp",
+	[RL_CLASS_TCP_SYN]	= "syn",
+	[RL_CLASS_OTHER]	= "other",
+};
+
+/* class=NAME,rate=PPS[,burst=N][,v4=LEN][,v6=LEN]. The burst defaults to
+ * one second of traffic, the prefixes to a single IPv4 host and an IPv6
+ * /64; rate=0 removes the limit.
+ */
+int rl_class_parse(const char *spec, __u32 *class, struct rl_class_cfg *cfg)
+{
+	char buf[256], *tok, *val, *end, *save = NULL;
+	bool has_class = false, has_rate = false;
+	unsigned long num;
+	__u32 i;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->prefix_v4 = 32;
+	cfg->prefix_v6 = 64;
+	snprintf(buf, sizeof(buf), "%s", spec);
+
+	for (tok = strtok_r(buf, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (!val)
+			return -EINVAL;
+		*val++ = '\0';
+
+		num = strtoul(val, &end, 0);
+		if (!strcmp(tok, "class")) {
+			for (i = 0; i < RL_CLASS_MAX; i++)
+				if (!strcmp(val, rl_class_names[i]))
+					break;
+			if (i == RL_CLASS_MAX)
+				return -EINVAL;
+			*class = i;
+			has_class = true;
+		} else if (*end) {
+			return -EINVAL;
+		} else if (!strcmp(tok, "rate")) {
+			if (num > NSEC_PER_SEC)
+				return -ERANGE;
+			cfg->rate = num;
+			has_rate = true;
+		} else if (!strcmp(tok, "burst")) {
+			if (!num || num > UINT32_MAX)
+				return -EINVAL;
+			cfg->burst = num;
+		} else if (!strcmp(tok, "v4")) {
+			if (num > 32)
+				return -EINVAL;
+			cfg->prefix_v4 = num;
+		} else if (!strcmp(tok, "v6")) {
+			if (num > 128)
+				return -EINVAL;
+			cfg->prefix_v6 = num;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	if (!has_class || !has_rate)
+		return -EINVAL;
+
+	if (!cfg->rate) {
+		cfg->burst = 0;
+		return 0;
+	}
+
+	if (!cfg->burst)
+		cfg->burst = cfg->rate;
+	cfg->cost_ns = NSEC_PER_SEC / cfg->rate;
+	cfg->depth_ns = cfg->cost_ns * cfg->burst;
+	return 0;
+}
+
+int rl_class_set(__u32 class, const struct rl_class_cfg *cfg)
+{
+	int fd, err = 0;
+
+	if (class >= RL_CLASS_MAX)
+		return -EINVAL;
+
+	fd = open_pinned_map("rl_classes");
+	if (fd < 0)
+		return fd;
+
+	if (bpf_map_update_elem(fd, &class, cfg, BPF_ANY))
+		err = -errno;
+
+	close(fd);
+	return err;
+}
+
+/* One line per class: its configuration and the packets it passed and
+ * limited, summed over all the CPUs.
+ */
+int rl_classes_print(void)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	int cfg_fd, stats_fd = -1, err = 0;
+	struct rl_class_cfg cfg;
+	struct rl_stats *values;
+	__u64 passed, limited;
+	__u32 class;
+	int i;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	values = calloc(nr_cpus, sizeof(*values));
+	if (!values)
+		return -ENOMEM;
+
+	cfg_fd = open_pinned_map("rl_classes");
+	if (cfg_fd < 0) {
+		err = cfg_fd;
+		goto out;
+	}
+	stats_fd = open_pinned_map("rl_stats");
+	if (stats_fd < 0) {
+		err = stats_fd;
+		goto out;
+	}
+
+	for (class = 0; class < RL_CLASS_MAX; class++) {
+		if (bpf_map_lookup_elem(cfg_fd, &class, &cfg) ||
+		    bpf_map_lookup_elem(stats_fd, &class, values)) {
+			err = -errno;
+			goto out;
+		}
+
+		passed = limited = 0;
+		for (i = 0; i < nr_cpus; i++) {
+			passed += values[i].passed;
+			limited += values[i].limited;
+		}
+
+		printf("class=%s", rl_class_names[class]);
+		if (cfg.rate)
+			printf(",rate=%u,burst=%u,v4=%u,v6=%u", cfg.rate,
+			       cfg.burst, cfg.prefix_v4, cfg.prefix_v6);
+		else
+			printf(",rate=0");
+		printf("  %llu passed %llu limited\n",
+		       (unsigned long long)passed, (unsigned long long)limited);
+	}
+
+out:
+	if (stats_fd >= 0)
+		close(stats_fd);
+	if (cfg_fd >= 0)
+		close(cfg_fd);
+	free(values);
+	return err;
+}
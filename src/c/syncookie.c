@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Userspace side of the xdp_prog_syncookie listeners.
+ *
+ * A listener is a TCP port in the pinned syncookie_listeners hash: adding it
+ * makes the program answer the SYNs to that port from XDP right away,
+ * deleting it hands them back to the stack. The entry is created with a
+ * zero refresh time, so the first SYN after it still goes to the listener
+ * and opens the window in which the kernel accepts cookies.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+
+int syncookie_listener_add(__u16 port)
+{
+	struct syncookie_listener lst = {};
+	int fd, err = 0;
+
+	fd = open_pinned_map("syncookie_listeners");
+	if (fd < 0)
+		return fd;
+
+	/* Leave the refresh time of a port already there alone */
+	if (bpf_map_update_elem(fd, &port, &lst, BPF_NOEXIST) &&
+	    errno != EEXIST)
+		err = -errno;
+
+	close(fd);
+	return err;
+}
+
+int syncookie_listener_del(__u16 port)
+{
+	int fd, err = 0;
+
+	fd = open_pinned_map("syncookie_listeners");
+	if (fd < 0)
+		return fd;
+
+	if (bpf_map_delete_elem(fd, &port))
+		err = -errno;
+
+	close(fd);
+	return err;
+}
+
+/* The listener ports, then the counters summed over all the CPUs */
+int syncookie_print(void)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+	int lst_fd, stats_fd = -1, err = 0;
+	struct syncookie_stats *values, sum = {};
+	__u16 port, *prev = NULL;
+	__u32 key = 0;
+	int i;
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	values = calloc(nr_cpus, sizeof(*values));
+	if (!values)
+		return -ENOMEM;
+
+	lst_fd = open_pinned_map("syncookie_listeners");
+	if (lst_fd < 0) {
+		err = lst_fd;
+		goto out;
+	}
+	stats_fd = open_pinned_map("syncookie_stats");
+	if (stats_fd < 0) {
+		err = stats_fd;
+		goto out;
+	}
+
+	printf("listeners:");
+	while (!bpf_map_get_next_key(lst_fd, prev, &port)) {
+		printf(" %u", port);
+		prev = &port;
+	}
+	printf("\n");
+
+	if (bpf_map_lookup_elem(stats_fd, &key, values)) {
+		err = -errno;
+		goto out;
+	}
+
+	for (i = 0; i < nr_cpus; i++) {
+		sum.syn_cookies += values[i].syn_cookies;
+		sum.syn_passed += values[i].syn_passed;
+		sum.ack_valid += values[i].ack_valid;
+		sum.ack_invalid += values[i].ack_invalid;
+	}
+
+	printf("%llu cookies sent %llu syn passed %llu ack valid %llu ack dropped\n",
+	       (unsigned long long)sum.syn_cookies,
+	       (unsigned long long)sum.syn_passed,
+	       (unsigned long long)sum.ack_valid,
+	       (unsigned long long)sum.ack_invalid);
+
+out:
+	if (stats_fd >= 0)
+		close(stats_fd);
+	if (lst_fd >= 0)
+		close(lst_fd);
+	free(values);
+	return err;
+}
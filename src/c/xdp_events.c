@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Consume the packet samples that netprog pushes into the xdp_events ring
+ * buffer. The producer only wakes us up once a batch of samples is pending
+ * (see XDP_EVENTS_WAKEUP_BYTES), so every poll drains many records and the
+ * output is flushed once per batch.
+ */
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "common_user.h"
+#include "netprog.skel.h"
+
+/* Pick up the samples left in the ring buffer when traffic stops */
+#define POLL_TIMEOUT_MS 100
+
+static volatile sig_atomic_t exiting;
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+static const struct option long_options[] = {
+	{ "map",	required_argument,	NULL, 'm' },
+	{ "rate",	required_argument,	NULL, 'r' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ 0, 0, NULL, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-m MAP] [-r RATE]\n"
+		"  -m, --map PATH   pinned ring buffer (default %s)\n"
+		"  -r, --rate N     sample one packet every N while running,\n"
+		"                   the stream is turned off again on exit\n",
+		prog, NETPROG_EVENTS_MAP);
+}
+
+/* The .bss of netprog is pinned next to the other maps, but the loader
+ * picks its name: look it up by the ".bss" suffix of the kernel-side map
+ * name and by its size. When it is not found, the error of the last pinned
+ * map that could not be inspected is returned, -ENOENT if there was none.
+ */
+static int open_pinned_bss(void)
+{
+	struct bpf_map_info info;
+	__u32 len = sizeof(info);
+	struct dirent *de;
+	char path[256];
+	int fd, err = -ENOENT;
+	size_t n;
+	DIR *dir;
+
+	dir = opendir(NETPROG_MAPS_DIR);
+	if (!dir) {
+		err = -errno;
+		fprintf(stderr, "ERR: cannot open %s: %s\n", NETPROG_MAPS_DIR,
+			strerror(-err));
+		return err;
+	}
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", NETPROG_MAPS_DIR,
+			 de->d_name);
+		fd = open_pinned_path(path);
+		if (fd < 0) {
+			err = fd;
+			continue;
+		}
+
+		memset(&info, 0, sizeof(info));
+		len = sizeof(info);
+		if (bpf_map_get_info_by_fd(fd, &info, &len)) {
+			err = -errno;
+			fprintf(stderr, "ERR: cannot read map info of %s: %s\n",
+				path, strerror(-err));
+			close(fd);
+			continue;
+		}
+
+		n = strlen(info.name);
+		if (n > 4 && !strcmp(info.name + n - 4, ".bss") &&
+		    info.value_size == sizeof(struct netprog_bpf__bss)) {
+			closedir(dir);
+			return fd;
+		}
+
+		close(fd);
+	}
+
+	closedir(dir);
+	return err;
+}
+
+/* Set the sampling rate knob, returning the previous value in @old */
+static int set_sample_rate(int bss_fd, __u32 rate, __u32 *old)
+{
+	struct netprog_bpf__bss bss;
+	__u32 key = 0;
+
+	if (bpf_map_lookup_elem(bss_fd, &key, &bss))
+		return -errno;
+
+	if (old)
+		*old = bss.event_sample_rate;
+	bss.event_sample_rate = rate;
+
+	if (bpf_map_update_elem(bss_fd, &key, &bss, BPF_ANY))
+		return -errno;
+
+	return 0;
+}
+
+static int handle_event(void *ctx, void *data, size_t size)
+{
+	const struct xdp_event *e = data;
+	char saddr[INET6_ADDRSTRLEN], daddr[INET6_ADDRSTRLEN];
+	const char *action;
+
+	if (size < sizeof(*e))
+		return 0;
+
+	inet_ntop(e->family, e->saddr, saddr, sizeof(saddr));
+	inet_ntop(e->family, e->daddr, daddr, sizeof(daddr));
+	action = xdp_action2str(e->action);
+
+	printf("%llu.%09llu if=%u %s %s.%u -> %s.%u proto=%u\n",
+	       e->timestamp / 1000000000ULL, e->timestamp % 1000000000ULL,
+	       e->ifindex, action ? action : "?", saddr, ntohs(e->sport),
+	       daddr, ntohs(e->dport), e->proto);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *map_path = NETPROG_EVENTS_MAP;
+	struct ring_buffer *rb = NULL;
+	__u32 rate = 0, old_rate = 0;
+	int map_fd, bss_fd = -1;
+	int opt, err = 0;
+
+	while ((opt = getopt_long(argc, argv, "m:r:h", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'm':
+			map_path = optarg;
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	map_fd = open_pinned_path(map_path);
+	if (map_fd < 0)
+		return EXIT_FAILURE;
+
+	rb = ring_buffer__new(map_fd, handle_event, NULL, NULL);
+	if (!rb) {
+		err = -errno;
+		fprintf(stderr, "ERR: cannot create ring buffer: %s\n",
+			strerror(-err));
+		goto out;
+	}
+
+	if (rate) {
+		bss_fd = open_pinned_bss();
+		if (bss_fd < 0) {
+			err = bss_fd;
+			fprintf(stderr, "ERR: cannot find netprog .bss in %s: %s\n",
+				NETPROG_MAPS_DIR, strerror(-err));
+			goto out;
+		}
+
+		err = set_sample_rate(bss_fd, rate, &old_rate);
+		if (err) {
+			fprintf(stderr, "ERR: cannot set sampling rate: %s\n",
+				strerror(-err));
+			goto out;
+		}
+	}
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	/* Flush once per batch, not once per line */
+	setvbuf(stdout, NULL, _IOFBF, 0);
+
+	while (!exiting) {
+		err = ring_buffer__poll(rb, POLL_TIMEOUT_MS);
+		if (err == -EINTR) {
+			err = 0;
+			break;
+		}
+		if (err < 0) {
+			fprintf(stderr, "ERR: polling ring buffer: %s\n",
+				strerror(-err));
+			break;
+		}
+		if (err > 0)
+			fflush(stdout);
+		err = 0;
+	}
+
+	if (bss_fd >= 0)
+		set_sample_rate(bss_fd, old_rate, NULL);
+
+out:
+	if (bss_fd >= 0)
+		close(bss_fd);
+	ring_buffer__free(rb);
+	close(map_fd);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
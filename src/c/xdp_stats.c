@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Print the per-action counters of netprog, reading the stats map pinned
+ * by the loader (or by "bpftool prog loadall ... pinmaps").
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+
+#include "common_user.h"
+
+static const struct option long_options[] = {
+	{ "map",	required_argument,	NULL, 'm' },
+	{ "interval",	required_argument,	NULL, 'i' },
+	{ "once",	no_argument,		NULL, 'o' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ 0, 0, NULL, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-m MAP] [-i SEC] [-o]\n"
+		"  -m, --map PATH     pinned stats map (default %s)\n"
+		"  -i, --interval SEC refresh period (default 1)\n"
+		"  -o, --once         print the totals once and exit\n",
+		prog, NETPROG_STATS_MAP);
+}
+
+int main(int argc, char **argv)
+{
+	const char *map_path = NETPROG_STATS_MAP;
+	struct stats_record rec, prev;
+	int interval = 1, once = 0;
+	int map_fd, opt, err;
+
+	while ((opt = getopt_long(argc, argv, "m:i:oh", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'm':
+			map_path = optarg;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			if (interval <= 0) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'o':
+			once = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	map_fd = open_pinned_path(map_path);
+	if (map_fd < 0)
+		return EXIT_FAILURE;
+
+	err = stats_collect(map_fd, &prev);
+	if (err) {
+		fprintf(stderr, "ERR: cannot read %s: %s\n", map_path,
+			strerror(-err));
+		goto out;
+	}
+
+	if (once) {
+		stats_print(&prev, NULL);
+		goto out;
+	}
+
+	for (;;) {
+		sleep(interval);
+
+		err = stats_collect(map_fd, &rec);
+		if (err) {
+			fprintf(stderr, "ERR: cannot read %s: %s\n", map_path,
+				strerror(-err));
+			break;
+		}
+
+		stats_print(&rec, &prev);
+		printf("\n");
+		prev = rec;
+	}
+
+out:
+	close(map_fd);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,573 @@
+// SPDX-License-Identifier: GPL-2.0
+/* AF_XDP consumer for xdp_prog_xsk: bind an XDP socket to one queue of an
+ * interface, register it in the pinned xsks_map and receive the frames that
+ * the program redirects, straight from the driver and without any skb.
+ *
+ *   netprog -q -p xdp_prog_xsk -i veth1
+ *   xdp_xsk -i veth1               count the redirected frames
+ *   xdp_xsk -i veth1 -r            also answer the ICMPv6 echo requests
+ *
+ * The socket owns a UMEM of XSK_NUM_FRAMES frames and its four rings: the
+ * fill ring hands free frames to the kernel, which returns them filled on
+ * the RX ring; frames queued on the TX ring come back on the completion ring
+ * once sent. With -r an echo request is turned into the reply in place and
+ * queued for TX in the same frame, so no packet is ever copied by us.
+ *
+ * The rings are drained in batches of up to -b descriptors, and each batch
+ * costs a single update of every producer and consumer index. The socket is
+ * bound with XDP_USE_NEED_WAKEUP: the kernel only needs a syscall when it
+ * raises the wakeup flag of a ring, so under load there is none at all.
+ *
+ * Zero-copy needs driver support; veth, like most virtual devices, only
+ * offers copy mode, which is still done by the driver in its XDP path.
+ * Without -z or -c zero-copy is tried first.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#include <linux/icmpv6.h>
+#include <linux/ipv6.h>
+#include <bpf/bpf.h>
+
+#include "common_user.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XSK_FRAME_SIZE		2048
+#define XSK_NUM_FRAMES		4096
+/* Every frame fits in the fill ring, so recycling one never fails */
+#define XSK_FILL_SIZE		XSK_NUM_FRAMES
+#define XSK_COMP_SIZE		XSK_NUM_FRAMES
+#define XSK_RX_SIZE		2048
+#define XSK_TX_SIZE		2048
+#define XSK_BATCH_MAX		XSK_RX_SIZE
+
+#define POLL_TIMEOUT_MS		1000
+
+/* One of the four rings shared with the kernel. The indexes are free
+ * running; we keep a private copy of the index we own and publish it once
+ * per batch, and read the other one with acquire semantics.
+ */
+struct xsk_ring {
+	__u32 *producer;
+	__u32 *consumer;
+	__u32 *flags;
+	void *desc;
+	__u32 size;
+	__u32 cached;		/* our index: producer or consumer */
+	void *map;
+	size_t map_len;
+};
+
+struct xsk {
+	int fd;
+	void *umem;
+	struct xsk_ring fill;
+	struct xsk_ring comp;
+	struct xsk_ring rx;
+	struct xsk_ring tx;
+	__u32 tx_pending;	/* queued on tx, not yet completed */
+	bool zerocopy;
+};
+
+struct config {
+	int ifindex;
+	const char *ifname;
+	__u32 queue;
+	__u16 bind_flags;	/* XDP_ZEROCOPY, XDP_COPY or 0 to try both */
+	__u32 batch;
+	bool reply;
+};
+
+struct xsk_stats {
+	__u64 rx;
+	__u64 tx;
+	__u64 tx_full;		/* replies dropped, the TX ring was full */
+};
+
+static volatile sig_atomic_t exiting;
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+static const struct option long_options[] = {
+	{ "dev",	required_argument,	NULL, 'i' },
+	{ "queue",	required_argument,	NULL, 'q' },
+	{ "zero-copy",	no_argument,		NULL, 'z' },
+	{ "copy",	no_argument,		NULL, 'c' },
+	{ "batch",	required_argument,	NULL, 'b' },
+	{ "reply",	no_argument,		NULL, 'r' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ 0, 0, NULL, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s -i IFNAME [OPTIONS]\n"
+		"  -i, --dev IFNAME    interface running xdp_prog_xsk\n"
+		"  -q, --queue N       RX queue to bind to (default 0)\n"
+		"  -z, --zero-copy     zero-copy mode only\n"
+		"  -c, --copy          copy mode only\n"
+		"  -b, --batch N       descriptors per batch (default 64, max %d)\n"
+		"  -r, --reply         answer ICMPv6 echo requests through TX\n",
+		prog, XSK_BATCH_MAX);
+}
+
+static int parse_args(int argc, char **argv, struct config *cfg)
+{
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "i:q:zcb:rh", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			cfg->ifindex = if_nametoindex(optarg);
+			if (!cfg->ifindex) {
+				fprintf(stderr, "ERR: unknown interface %s\n",
+					optarg);
+				return -EINVAL;
+			}
+			cfg->ifname = optarg;
+			break;
+		case 'q':
+			cfg->queue = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			cfg->bind_flags = XDP_ZEROCOPY;
+			break;
+		case 'c':
+			cfg->bind_flags = XDP_COPY;
+			break;
+		case 'b':
+			cfg->batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg->reply = true;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (!cfg->ifindex || cfg->queue >= XSK_MAX_QUEUES || !cfg->batch ||
+	    cfg->batch > XSK_BATCH_MAX)
+		return -EINVAL;
+
+	return 0;
+}
+
+static __u32 ring_load_acquire(__u32 *index)
+{
+	return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static void ring_store_release(__u32 *index, __u32 value)
+{
+	__atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+/* Entries we can produce: the kernel consumes up to its consumer index */
+static __u32 ring_free(struct xsk_ring *r)
+{
+	return r->size - (r->cached - ring_load_acquire(r->consumer));
+}
+
+/* Entries we can consume: the kernel produced up to its producer index */
+static __u32 ring_avail(struct xsk_ring *r)
+{
+	return ring_load_acquire(r->producer) - r->cached;
+}
+
+static __u64 *ring_addr(struct xsk_ring *r, __u32 idx)
+{
+	return &((__u64 *)r->desc)[idx & (r->size - 1)];
+}
+
+static struct xdp_desc *ring_desc(struct xsk_ring *r, __u32 idx)
+{
+	return &((struct xdp_desc *)r->desc)[idx & (r->size - 1)];
+}
+
+static bool ring_needs_wakeup(struct xsk_ring *r)
+{
+	return __atomic_load_n(r->flags, __ATOMIC_RELAXED) &
+	       XDP_RING_NEED_WAKEUP;
+}
+
+static int ring_setup(int fd, int opt, __u32 size)
+{
+	return setsockopt(fd, SOL_XDP, opt, &size, sizeof(size)) ? -errno : 0;
+}
+
+static int ring_mmap(int fd, struct xsk_ring *r, const struct xdp_ring_offset *off,
+		     __u32 size, size_t desc_size, off_t pgoff)
+{
+	r->map_len = off->desc + size * desc_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -errno;
+	}
+
+	r->producer = r->map + off->producer;
+	r->consumer = r->map + off->consumer;
+	r->flags = r->map + off->flags;
+	r->desc = r->map + off->desc;
+	r->size = size;
+	return 0;
+}
+
+static int xsk_bind(struct xsk *xsk, const struct config *cfg)
+{
+	struct sockaddr_xdp sxdp = {
+		.sxdp_family = AF_XDP,
+		.sxdp_ifindex = cfg->ifindex,
+		.sxdp_queue_id = cfg->queue,
+	};
+
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP |
+			  (cfg->bind_flags ? cfg->bind_flags : XDP_ZEROCOPY);
+	if (!bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+		xsk->zerocopy = sxdp.sxdp_flags & XDP_ZEROCOPY;
+		return 0;
+	}
+	if (cfg->bind_flags)
+		return -errno;
+
+	/* The socket stays unbound on failure and can be bound again */
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+	if (bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)))
+		return -errno;
+
+	xsk->zerocopy = false;
+	return 0;
+}
+
+static void xsk_destroy(struct xsk *xsk)
+{
+	struct xsk_ring *rings[] = { &xsk->fill, &xsk->comp, &xsk->rx, &xsk->tx };
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (rings[i]->map)
+			munmap(rings[i]->map, rings[i]->map_len);
+	if (xsk->fd >= 0)
+		close(xsk->fd);
+	if (xsk->umem)
+		munmap(xsk->umem, (size_t)XSK_NUM_FRAMES * XSK_FRAME_SIZE);
+}
+
+/* Register the UMEM, create and map the rings, bind to the queue and hand
+ * every frame to the kernel through the fill ring.
+ */
+static int xsk_create(struct xsk *xsk, const struct config *cfg)
+{
+	struct xdp_umem_reg mr = {
+		.len = (__u64)XSK_NUM_FRAMES * XSK_FRAME_SIZE,
+		.chunk_size = XSK_FRAME_SIZE,
+	};
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	__u32 i;
+	int err;
+
+	memset(xsk, 0, sizeof(*xsk));
+	xsk->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (xsk->fd < 0)
+		return -errno;
+
+	xsk->umem = mmap(NULL, mr.len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (xsk->umem == MAP_FAILED) {
+		xsk->umem = NULL;
+		return -errno;
+	}
+	mr.addr = (__u64)(unsigned long)xsk->umem;
+
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)))
+		return -errno;
+
+	err = ring_setup(xsk->fd, XDP_UMEM_FILL_RING, XSK_FILL_SIZE);
+	if (!err)
+		err = ring_setup(xsk->fd, XDP_UMEM_COMPLETION_RING, XSK_COMP_SIZE);
+	if (!err)
+		err = ring_setup(xsk->fd, XDP_RX_RING, XSK_RX_SIZE);
+	if (!err)
+		err = ring_setup(xsk->fd, XDP_TX_RING, XSK_TX_SIZE);
+	if (err)
+		return err;
+
+	if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen))
+		return -errno;
+
+	err = ring_mmap(xsk->fd, &xsk->fill, &off.fr, XSK_FILL_SIZE,
+			sizeof(__u64), XDP_UMEM_PGOFF_FILL_RING);
+	if (!err)
+		err = ring_mmap(xsk->fd, &xsk->comp, &off.cr, XSK_COMP_SIZE,
+				sizeof(__u64), XDP_UMEM_PGOFF_COMPLETION_RING);
+	if (!err)
+		err = ring_mmap(xsk->fd, &xsk->rx, &off.rx, XSK_RX_SIZE,
+				sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+	if (!err)
+		err = ring_mmap(xsk->fd, &xsk->tx, &off.tx, XSK_TX_SIZE,
+				sizeof(struct xdp_desc), XDP_PGOFF_TX_RING);
+	if (err)
+		return err;
+
+	/* Our copies start from the indexes the kernel published */
+	xsk->fill.cached = *xsk->fill.producer;
+	xsk->comp.cached = *xsk->comp.consumer;
+	xsk->rx.cached = *xsk->rx.consumer;
+	xsk->tx.cached = *xsk->tx.producer;
+
+	err = xsk_bind(xsk, cfg);
+	if (err)
+		return err;
+
+	for (i = 0; i < XSK_NUM_FRAMES; i++)
+		*ring_addr(&xsk->fill, xsk->fill.cached++) =
+			(__u64)i * XSK_FRAME_SIZE;
+	ring_store_release(xsk->fill.producer, xsk->fill.cached);
+
+	return 0;
+}
+
+/* RFC 1624 incremental update of a checksum for a 16-bit word change */
+static __u16 csum_replace2(__u16 check, __u16 old, __u16 new)
+{
+	__u32 sum = (__u16)~check + (__u16)~old + new;
+
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return ~sum;
+}
+
+/* Turn an untagged ICMPv6 echo request without extension headers into its
+ * reply, in place. Swapping the addresses does not change the pseudo-header
+ * sum, so only the type needs to be folded into the checksum.
+ */
+static bool icmp6_echo_reply(void *frame, __u32 len)
+{
+	struct ethhdr *eth = frame;
+	struct ipv6hdr *ip6h = (void *)(eth + 1);
+	struct icmp6hdr *icmp6h = (void *)(ip6h + 1);
+	unsigned char mac[ETH_ALEN];
+	struct in6_addr addr;
+	__u16 old, new;
+
+	if (len < sizeof(*eth) + sizeof(*ip6h) + sizeof(*icmp6h) ||
+	    eth->h_proto != htons(ETH_P_IPV6) ||
+	    ip6h->nexthdr != IPPROTO_ICMPV6 ||
+	    icmp6h->icmp6_type != ICMPV6_ECHO_REQUEST)
+		return false;
+
+	memcpy(mac, eth->h_dest, ETH_ALEN);
+	memcpy(eth->h_dest, eth->h_source, ETH_ALEN);
+	memcpy(eth->h_source, mac, ETH_ALEN);
+
+	addr = ip6h->daddr;
+	ip6h->daddr = ip6h->saddr;
+	ip6h->saddr = addr;
+	ip6h->hop_limit = 64;
+
+	memcpy(&old, icmp6h, sizeof(old));
+	icmp6h->icmp6_type = ICMPV6_ECHO_REPLY;
+	memcpy(&new, icmp6h, sizeof(new));
+	icmp6h->icmp6_cksum = csum_replace2(icmp6h->icmp6_cksum, old, new);
+	return true;
+}
+
+/* Return the frames of the transmitted packets to the fill ring */
+static void xsk_complete_tx(struct xsk *xsk)
+{
+	__u32 n, i;
+
+	if (!xsk->tx_pending)
+		return;
+
+	/* Copy mode only sends when asked to */
+	if (!xsk->zerocopy || ring_needs_wakeup(&xsk->tx))
+		sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+
+	n = ring_avail(&xsk->comp);
+	if (!n)
+		return;
+
+	for (i = 0; i < n; i++)
+		*ring_addr(&xsk->fill, xsk->fill.cached++) =
+			*ring_addr(&xsk->comp, xsk->comp.cached++);
+
+	ring_store_release(xsk->comp.consumer, xsk->comp.cached);
+	ring_store_release(xsk->fill.producer, xsk->fill.cached);
+	xsk->tx_pending -= n;
+}
+
+/* Process one batch of received frames: each one is either queued back for
+ * TX as a reply or recycled to the fill ring right away.
+ */
+static void xsk_rx_batch(struct xsk *xsk, const struct config *cfg,
+			 struct xsk_stats *st)
+{
+	__u32 n, i, tx_free, queued = 0;
+	struct xdp_desc *desc;
+
+	n = ring_avail(&xsk->rx);
+	if (n > cfg->batch)
+		n = cfg->batch;
+
+	tx_free = cfg->reply ? ring_free(&xsk->tx) : 0;
+
+	for (i = 0; i < n; i++) {
+		desc = ring_desc(&xsk->rx, xsk->rx.cached++);
+
+		if (cfg->reply && icmp6_echo_reply(xsk->umem + desc->addr,
+						   desc->len)) {
+			if (queued < tx_free) {
+				*ring_desc(&xsk->tx, xsk->tx.cached++) = *desc;
+				queued++;
+				continue;
+			}
+			st->tx_full++;
+		}
+
+		*ring_addr(&xsk->fill, xsk->fill.cached++) = desc->addr;
+	}
+
+	ring_store_release(xsk->rx.consumer, xsk->rx.cached);
+	ring_store_release(xsk->fill.producer, xsk->fill.cached);
+	if (queued) {
+		ring_store_release(xsk->tx.producer, xsk->tx.cached);
+		xsk->tx_pending += queued;
+	}
+
+	st->rx += n;
+	st->tx += queued;
+}
+
+static __u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stats_print_xsk(const struct xsk_stats *st,
+			    const struct xsk_stats *prev, __u64 period)
+{
+	double secs = period / 1e9;
+
+	printf("rx %12.0f pps  tx %12.0f pps  rx total %llu  tx full %llu\n",
+	       (st->rx - prev->rx) / secs, (st->tx - prev->tx) / secs,
+	       (unsigned long long)st->rx, (unsigned long long)st->tx_full);
+	fflush(stdout);
+}
+
+static int xsk_loop(struct xsk *xsk, const struct config *cfg)
+{
+	struct pollfd pfd = { .fd = xsk->fd, .events = POLLIN };
+	struct xsk_stats st = {}, prev = {};
+	__u64 last = now_ns(), now;
+
+	while (!exiting) {
+		/* Sleep only when there is nothing to do */
+		if (!ring_avail(&xsk->rx) &&
+		    poll(&pfd, 1, POLL_TIMEOUT_MS) < 0 && errno != EINTR)
+			return -errno;
+
+		xsk_rx_batch(xsk, cfg, &st);
+		xsk_complete_tx(xsk);
+
+		/* The kernel ran out of frames and stopped refilling */
+		if (ring_needs_wakeup(&xsk->fill))
+			recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+		now = now_ns();
+		if (now - last >= 1000000000ULL) {
+			stats_print_xsk(&st, &prev, now - last);
+			prev = st;
+			last = now;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct config cfg = {
+		.batch = 64,
+	};
+	struct xsk xsk;
+	int map_fd, err;
+
+	if (parse_args(argc, argv, &cfg)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	map_fd = open_pinned_path(NETPROG_XSKS_MAP);
+	if (map_fd < 0) {
+		if (map_fd == -ENOENT)
+			fprintf(stderr, "ERR: is xdp_prog_xsk loaded?\n");
+		return EXIT_FAILURE;
+	}
+
+	err = xsk_create(&xsk, &cfg);
+	if (err) {
+		fprintf(stderr, "ERR: cannot create the AF_XDP socket on %s "
+			"queue %u: %s\n", cfg.ifname, cfg.queue, strerror(-err));
+		if (err == -EAFNOSUPPORT)
+			fprintf(stderr, "ERR: the kernel needs CONFIG_XDP_SOCKETS\n");
+		goto out;
+	}
+
+	if (bpf_map_update_elem(map_fd, &cfg.queue, &xsk.fd, BPF_ANY)) {
+		err = -errno;
+		fprintf(stderr, "ERR: cannot add the socket to %s: %s\n",
+			NETPROG_XSKS_MAP, strerror(-err));
+		goto out;
+	}
+
+	printf("%s: queue %u bound in %s mode%s\n", cfg.ifname, cfg.queue,
+	       xsk.zerocopy ? "zero-copy" : "copy",
+	       cfg.reply ? ", answering echo requests" : "");
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	err = xsk_loop(&xsk, &cfg);
+	if (err)
+		fprintf(stderr, "ERR: polling the socket: %s\n", strerror(-err));
+
+	/* Closing the socket removes it from the map as well, do it now so
+	 * that the pings go back to the stack before we are gone.
+	 */
+	bpf_map_delete_elem(map_fd, &cfg.queue);
+out:
+	xsk_destroy(&xsk);
+	close(map_fd);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+#!/bin/bash
+#
+# Measure the per-packet cost of xdp_prog_blocklist as the blocklist grows.
+# Run routing.sh or xdp_icmpv6_drop.sh first (the namespaces outlive the
+# tmux session), then:
+#
+#   ./bench_blocklist.sh -x netprog [-r repeat] [-s "0 1000 100000 ..."]
+#
+# For each size a blocklist of random IPv4 hosts outside 10.0.0.0/8 is
+# generated, netprog attaches xdp_prog_blocklist to veth1 in r0 and loads
+# it with -b, and bpftool runs the attached program through
+# BPF_PROG_TEST_RUN on three 64 byte UDP frames, printing the average time
+# per run in nanoseconds:
+#
+#   miss     source in no blocked network, stops at the bloom filter
+#   near     source next to a blocked host, in the bloom filter but not in
+#            the trie, the price of a bloom false positive
+#   blocked  blocked source, bloom filter and trie lookup, then the drop
+#
+# The program is loaded afresh for every size: netprog runs on a private
+# BPF filesystem and its maps and link go away with it. bpftool is needed.
+
+set -e
+set -u
+
+REPEAT=1000000
+SIZES="0 1000 10000 100000 500000 1000000"
+NETPROG=""
+
+while getopts "r:s:x:" opt; do
+	case "${opt}" in
+	r) REPEAT="${OPTARG}" ;;
+	s) SIZES="${OPTARG}" ;;
+	x) NETPROG="$(realpath "${OPTARG}")" ;;
+	*) echo "usage: $0 -x netprog [-r repeat] [-s sizes]" >&2
+	   exit 1 ;;
+	esac
+done
+
+if [ -z "${NETPROG}" ]; then
+	echo "usage: $0 -x netprog [-r repeat] [-s sizes]" >&2
+	exit 1
+fi
+
+if ! command -v bpftool > /dev/null; then
+	echo "bpftool is needed to run the program" >&2
+	exit 1
+fi
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "${tmp}"' EXIT
+
+# 64 byte Ethernet/IPv4/UDP frame from $1 to 10.0.0.254
+frame_v4()
+{
+	local a b c d
+
+	IFS=. read -r a b c d <<< "$1"
+	printf '\x02\x00\x00\x00\x00\x01\x02\x00\x00\x00\x00\x02\x08\x00'
+	printf '\x45\x00\x00\x32\x00\x00\x40\x00\x40\x11\x00\x00'
+	printf "$(printf '\\x%02x\\x%02x\\x%02x\\x%02x' "$a" "$b" "$c" "$d")"
+	printf '\x0a\x00\x00\xfe'
+	printf '\x30\x39\x30\x39\x00\x1e\x00\x00'
+	head -c 22 /dev/zero
+}
+
+# Runs in r0, on its own BPF filesystem: attach, load $2, time the frames
+cat > "${tmp}/run.sh" << 'EOF'
+set -e
+netprog="$1"; list="$2"; repeat="$3"; dir="$4"
+
+mount -t bpf bpf /sys/fs/bpf
+"${netprog}" -q -p xdp_prog_blocklist -i veth1 -b "${list}" > /dev/null
+id="$(ip link show dev veth1 | sed -n 's/.*prog\/xdp id \([0-9]*\).*/\1/p')"
+
+for probe in miss near blocked; do
+	bpftool prog run id "${id}" data_in "${dir}/${probe}.bin" \
+		repeat "${repeat}" | sed -n 's/.*(average): \([0-9]*\)ns.*/\1/p'
+done
+EOF
+
+printf "%10s %8s %8s %8s\n" entries miss near blocked
+for size in ${SIZES}; do
+	awk -v n="${size}" 'BEGIN {
+		srand(1)
+		for (i = 0; i < n; i++)
+			printf "%d.%d.%d.%d\n", 11 + int(rand() * 100),
+			       int(rand() * 256), int(rand() * 256),
+			       int(rand() * 256)
+	}' > "${tmp}/list"
+
+	# Without entries every probe stops at the bloom filter
+	blocked="$(head -n 1 "${tmp}/list")"
+	blocked="${blocked:-11.0.0.1}"
+	frame_v4 10.0.0.1 > "${tmp}/miss.bin"
+	frame_v4 "${blocked%.*}.$(( (${blocked##*.} + 1) % 256 ))" \
+		> "${tmp}/near.bin"
+	frame_v4 "${blocked}" > "${tmp}/blocked.bin"
+
+	printf "%10s %8s %8s %8s\n" "${size}" $(ip netns exec r0 unshare -m \
+		sh "${tmp}/run.sh" "${NETPROG}" "${tmp}/list" "${REPEAT}" \
+		"${tmp}")
+done
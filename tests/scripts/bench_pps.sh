@@ -0,0 +1,137 @@
+#!/bin/bash
+#
+# Measure the packet rate forwarded by r0 (veth1 -> veth2) in the h0/r0/h1
+# topology built by routing.sh or xdp_icmpv6_drop.sh. Run one of those
+# scripts first (the namespaces outlive the tmux session), then:
+#
+#   ./bench_pps.sh [-d seconds] [-k packet_counter.ko] [-b pcount] [-x netprog]
+#
+# With -k the measure is taken twice, before and after loading the module,
+# so that the cost of the netfilter hook shows up as a pps delta.
+#
+# With -b the same is done with pcount, the BPF port of the module, attached
+# to the netfilter hooks of r0 through bpf_links. Given together, -k and -b
+# take three measures in a row (none, module, BPF) on the same traffic, so
+# that the two implementations are compared directly. The module is then
+# loaded with flows=0 histograms=0, since pcount has neither; it still counts
+# ports at every hook, three times per forwarded packet, while pcount only
+# counts them at PRE_ROUTING. Like netprog below, pcount runs on a private
+# BPF filesystem and its links go away with it.
+#
+# With -x the measure is taken twice as well, once with the kernel
+# forwarding and once with xdp_prog_router attached to both r0 ports by the
+# given netprog binary. netprog runs on a private BPF filesystem: its links
+# go away, and r0 is back to kernel forwarding, when it is stopped. -x needs
+# the topology of routing.sh: xdp_icmpv6_drop.sh leaves an XDP program on
+# veth1 and xdp_router.sh already runs the router. It cannot be combined
+# with -k or -b.
+#
+# Traffic is a single UDP flow of 64 byte datagrams sent by iperf3 from h0
+# to h1; the rate is read from the veth2 tx counter inside r0.
+
+set -e
+set -u
+
+readonly SERVER=10.0.2.1
+readonly PAYLOAD_LEN=64
+
+DURATION=10
+KMOD=""
+PCOUNT=""
+NETPROG=""
+
+while getopts "d:k:b:x:" opt; do
+	case "${opt}" in
+	d) DURATION="${OPTARG}" ;;
+	k) KMOD="${OPTARG}" ;;
+	b) PCOUNT="$(realpath "${OPTARG}")" ;;
+	x) NETPROG="$(realpath "${OPTARG}")" ;;
+	*) echo "usage: $0 [-d seconds] [-k module.ko] [-b pcount] [-x netprog]" >&2
+	   exit 1 ;;
+	esac
+done
+
+if [ -n "${NETPROG}" ] && [ -n "${KMOD}${PCOUNT}" ]; then
+	echo "-x cannot be combined with -k or -b" >&2
+	exit 1
+fi
+
+# Only what pcount does too: no flow tracking, no histograms
+KMOD_ARGS=""
+if [ -n "${PCOUNT}" ]; then
+	KMOD_ARGS="flows=0 histograms=0"
+fi
+
+r0_tx_packets()
+{
+	ip netns exec r0 cat /sys/class/net/veth2/statistics/tx_packets
+}
+
+run_bench()
+{
+	local label="$1"
+	local before after
+
+	# one-shot server, it exits once the client is done
+	ip netns exec h1 iperf3 -s -1 -D
+	sleep 1
+
+	before="$(r0_tx_packets)"
+	ip netns exec h0 iperf3 -c "${SERVER}" -u -b 0 -l "${PAYLOAD_LEN}" \
+		-t "${DURATION}" > /dev/null
+	after="$(r0_tx_packets)"
+
+	echo "${label}: $(( (after - before) / DURATION )) pps"
+}
+
+if [ -n "${NETPROG}" ]; then
+	run_bench "kernel forwarding"
+
+	# A veth only receives redirected frames when its NAPI is enabled, i.e.
+	# with an XDP program or GRO on the receiving end; see xdp_router.sh
+	ip netns exec h0 ethtool -K veth0 gro on
+	ip netns exec h1 ethtool -K veth3 gro on
+
+	ip netns exec r0 unshare -m sh -c "
+		mount -t bpf bpf /sys/fs/bpf &&
+		exec ${NETPROG} -p xdp_prog_router -i veth1 -i veth2" \
+		> /dev/null &
+	netprog_pid=$!
+	trap 'kill ${netprog_pid} 2>/dev/null || true' EXIT
+	sleep 2
+
+	# Let the kernel resolve the neighbours the XDP path relies on
+	ip netns exec h0 ping -c 1 -W 1 "${SERVER}" > /dev/null || true
+
+	run_bench "xdp_prog_router"
+	exit 0
+fi
+
+if [ -z "${KMOD}" ] && [ -z "${PCOUNT}" ]; then
+	run_bench "r0"
+	exit 0
+fi
+
+if [ -n "${KMOD}" ]; then
+	rmmod "$(basename "${KMOD}" .ko)" 2>/dev/null || true
+fi
+run_bench "without counters"
+
+if [ -n "${KMOD}" ]; then
+	insmod "${KMOD}" ${KMOD_ARGS}
+	run_bench "with $(basename "${KMOD}")${KMOD_ARGS:+ (${KMOD_ARGS})}"
+	rmmod "$(basename "${KMOD}" .ko)"
+fi
+
+if [ -n "${PCOUNT}" ]; then
+	ip netns exec r0 unshare -m sh -c "
+		mount -t bpf bpf /sys/fs/bpf &&
+		exec ${PCOUNT}" > /dev/null &
+	pcount_pid=$!
+	trap 'kill ${pcount_pid} 2>/dev/null || true' EXIT
+	sleep 2
+
+	run_bench "with pcount (BPF netfilter link, ports at PRE_ROUTING only)"
+	kill "${pcount_pid}"
+	wait "${pcount_pid}" 2>/dev/null || true
+fi
@@ -0,0 +1,105 @@
+#!/bin/bash
+#
+# Flood a TCP listener on r0 with spoofed SYNs from h0 and measure how many
+# legitimate connections still get through, in the h0/r0/h1 topology built
+# by routing.sh or xdp_icmpv6_drop.sh. Run one of those scripts first (the
+# namespaces outlive the tmux session), then:
+#
+#   ./syn_flood.sh [-n connections] [-x netprog]
+#
+# The listener is an iperf3 server on 10.0.0.254:5201. hping3 floods it with
+# SYNs from random sources while h0 opens connections to it one at a time;
+# each one counts as established if the handshake completes within a second.
+#
+# With -x the measure is taken twice, once with the kernel alone and once
+# with xdp_prog_syncookie attached to veth1 by the given netprog binary,
+# answering the SYNs to 5201 from XDP. netprog runs on a private BPF
+# filesystem: its link goes away, and the kernel handles the SYNs again,
+# when it is stopped. r0 runs with net.ipv4.tcp_syncookies=2 in both cases,
+# see SYNCOOKIE_REFRESH_NS in common.h.
+
+set -e
+set -u
+
+readonly SERVER=10.0.0.254
+readonly PORT=5201
+
+CONNECTIONS=100
+NETPROG=""
+
+while getopts "n:x:" opt; do
+	case "${opt}" in
+	n) CONNECTIONS="${OPTARG}" ;;
+	x) NETPROG="$(realpath "${OPTARG}")" ;;
+	*) echo "usage: $0 [-n connections] [-x netprog]" >&2
+	   exit 1 ;;
+	esac
+done
+
+if ! command -v hping3 > /dev/null; then
+	echo "hping3 is needed to generate the flood" >&2
+	exit 1
+fi
+
+r0_syncookies_sent()
+{
+	ip netns exec r0 nstat -az TcpExtSyncookiesSent | \
+		awk '/TcpExtSyncookiesSent/ { print $2 }'
+}
+
+run_flood()
+{
+	local label="$1"
+	local ok=0 i start end before after flood_pid
+
+	ip netns exec h0 hping3 -S --flood --rand-source -p "${PORT}" \
+		"${SERVER}" > /dev/null 2>&1 &
+	flood_pid=$!
+	sleep 2
+
+	before="$(r0_syncookies_sent)"
+	start="$(date +%s%N)"
+	for i in $(seq "${CONNECTIONS}"); do
+		if ip netns exec h0 timeout 1 \
+			bash -c "exec 3<>/dev/tcp/${SERVER}/${PORT}" 2>/dev/null; then
+			ok=$((ok + 1))
+		fi
+	done
+	end="$(date +%s%N)"
+	after="$(r0_syncookies_sent)"
+
+	kill "${flood_pid}"
+	wait "${flood_pid}" 2>/dev/null || true
+
+	echo "${label}: ${ok}/${CONNECTIONS} established in" \
+	     "$(( (end - start) / 1000000 )) ms," \
+	     "$((after - before)) cookies sent by the kernel"
+}
+
+ip netns exec r0 sysctl -q -w net.ipv4.tcp_syncookies=2
+ip netns exec r0 iperf3 -s -p "${PORT}" -D
+trap 'ip netns exec r0 pkill -x iperf3 || true' EXIT
+sleep 1
+
+# Let the kernel resolve h0 before the SYN-ACKs go out from XDP
+ip netns exec h0 ping -c 1 -W 1 "${SERVER}" > /dev/null || true
+
+run_flood "kernel"
+
+if [ -n "${NETPROG}" ]; then
+	# The SYN-ACKs leave r0 with XDP_TX, and a veth only receives such
+	# frames when its peer has NAPI enabled, i.e. with an XDP program or
+	# GRO on h0's end; see xdp_router.sh
+	ip netns exec h0 ethtool -K veth0 gro on
+
+	ip netns exec r0 unshare -m sh -c "
+		mount -t bpf bpf /sys/fs/bpf &&
+		${NETPROG} -q -p xdp_prog_syncookie -i veth1 -k ${PORT} &&
+		exec sleep infinity" > /dev/null &
+	netprog_pid=$!
+	trap 'kill ${netprog_pid} 2>/dev/null || true;
+	      ip netns exec r0 pkill -x iperf3 || true' EXIT
+	sleep 2
+
+	run_flood "xdp_prog_syncookie"
+fi
@@ -70,26 +70,57 @@ read -r -d '' r0_env <<-EOF
 	#   the parent process's PID that launched this bash.
 	#
 	mount -t bpf bpf /sys/fs/bpf/
-	mkdir -p /sys/fs/bpf/netprog/{progs,maps}
 
 	mount -t tracefs nodev /sys/kernel/tracing
 
         # It allows to load maps with many entries without failing
         ulimit -l unlimited
 
-	# The command bpftool prog loadall netprog.bpf.o /sys/fs/bpf/netprog
-	# loads a BPF program from the object file netprog.bpf.o into the
-	# kernel and attaches it with the identifier or link name netprog,
-	# storing it in the specified BPF filesystem directory /sys/fs/bpf/.
-	bpftool prog \
-		loadall netprog.bpf.o /sys/fs/bpf/netprog/progs \
-		pinmaps /sys/fs/bpf/netprog/maps
-
-	# The command attaches an eBPF program pinned at
-	# /sys/fs/bpf/netprog/xdp_prog_drop_icmpv6 to the veth1 network
-	# interface using bpftool net attach xdp.
-	bpftool net attach xdp \
-		pinned /sys/fs/bpf/netprog/progs/xdp_prog_drop_icmpv6 dev veth1
+	# The netprog loader opens and loads the BPF skeleton embedded in the
+	# binary, pins its maps under /sys/fs/bpf/netprog/maps and attaches
+	# xdp_prog_drop_icmpv6 to veth1 in native mode, falling back to
+	# generic mode when the driver does not support XDP. With -q it exits
+	# right after attaching; run it without -q (or use xdp_stats) to see
+	# live pps/bps per XDP action, and xdp_events to sample the drops.
+	#
+	# The program is attached through a bpf_link pinned in
+	# /sys/fs/bpf/netprog/links: running a newer netprog the same way
+	# swaps the program atomically and keeps the pinned counters.
+	#
+	# The same policy can be expressed with the ACL engine, whose rules
+	# can be changed at any time without reloading the program:
+	#   ./netprog -q -p xdp_prog_acl -i veth1 \
+	#	-r prio=0,action=drop,proto=icmpv6
+	#   ./netprog -r prio=1,action=drop,src=10.0.0.0/24,proto=tcp,dport=22
+	#   ./netprog -l
+	#
+	# Both filters can also run on veth1 together: the dispatcher parses
+	# the headers once and tail-calls the ACL, then the ICMPv6 filter,
+	# handing each one the parsed headers in a per-CPU scratch map:
+	#   ./netprog -q -c acl,icmpv6 -i veth1
+	#
+	# Instead of dropping every ping, xdp_prog_ratelimit gives each source
+	# a token bucket of 10 pings per second, bursts of 5, and drops the
+	# excess in XDP, before any skb is allocated; "ping -6 -f cafe::254"
+	# from h0 then loses most of its requests:
+	#   ./netprog -q -p xdp_prog_ratelimit -i veth1
+	#   ./netprog -L class=icmp,rate=10,burst=5
+	#   ./netprog -t
+	#
+	# SYN floods against a TCP port of r0 are answered with SYN cookies
+	# from XDP, so that only completed handshakes reach the listener;
+	# syn_flood.sh measures the difference under hping3:
+	#   sysctl -w net.ipv4.tcp_syncookies=2
+	#   ./netprog -q -p xdp_prog_syncookie -i veth1 -k 5201
+	#   ./netprog -y
+	#
+	# Large source blocklists go to xdp_prog_blocklist, loaded in bulk
+	# from a file with one address or prefix per line; a bloom filter
+	# spares the LPM lookup to the sources that match nothing, and
+	# bench_blocklist.sh measures the cost per packet as the list grows:
+	#   ./netprog -q -p xdp_prog_blocklist -i veth1 -b blocklist.txt
+	#   ./netprog -B
+	./netprog -q -i veth1
 
         /bin/bash
 EOF
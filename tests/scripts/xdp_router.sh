@@ -0,0 +1,113 @@
+#!/bin/bash
+#
+# Same h0/r0/h1 topology as routing.sh, but r0 forwards in XDP: netprog
+# attaches xdp_prog_router to veth1 and veth2, which routes every packet
+# with bpf_fib_lookup() and redirects it to the egress veth through the
+# xdp_tx_ports devmap, bypassing the kernel stack. To compare it with plain
+# kernel forwarding, build the topology with routing.sh instead and run
+# "bench_pps.sh -x ./netprog", which attaches the same program itself.
+
+set -ex
+set -u
+
+readonly TMUX=ipv6
+
+# Kill tmux previous session
+tmux kill-session -t "${TMUX}" 2>/dev/null || true
+
+# Clean up previous network namespaces
+ip -all netns delete
+
+ip netns add h0
+ip netns add h1
+ip netns add r0
+
+
+ip link add veth0 type veth peer name veth1
+ip link add veth2 type veth peer name veth3
+
+ip link set veth0 netns h0
+ip link set veth1 netns r0
+ip link set veth2 netns r0
+ip link set veth3 netns h1
+
+###################
+#### Node: h0 #####
+###################
+echo -e "\nNode: h0"
+ip netns exec h0 ip link set dev lo up
+ip netns exec h0 ip link set dev veth0 up
+ip netns exec h0 ip addr add 10.0.0.1/24 dev veth0
+ip netns exec h0 ip addr add cafe::1/64 dev veth0
+
+ip netns exec h0 ip -6 route add default via cafe::254 dev veth0
+ip netns exec h0 ip -4 route add default via 10.0.0.254 dev veth0
+
+# A veth only receives redirected frames when its NAPI is enabled, i.e.
+# with an XDP program or GRO on the receiving end
+ip netns exec h0 ethtool -K veth0 gro on
+
+###################
+#### Node: r0 #####
+###################
+echo -e "\nNode: r0"
+
+ip netns exec r0 sysctl -w net.ipv4.ip_forward=1
+ip netns exec r0 sysctl -w net.ipv6.conf.all.forwarding=1
+ip netns exec r0 sysctl -w net.ipv4.conf.all.rp_filter=0
+ip netns exec r0 sysctl -w net.ipv4.conf.veth1.rp_filter=0
+ip netns exec r0 sysctl -w net.ipv4.conf.veth2.rp_filter=0
+
+ip netns exec r0 ip link set dev lo up
+ip netns exec r0 ip link set dev veth1 up
+ip netns exec r0 ip link set dev veth2 up
+
+ip netns exec r0 ip addr add cafe::254/64 dev veth1
+ip netns exec r0 ip addr add 10.0.0.254/24 dev veth1
+
+ip netns exec r0 ip addr add beef::254/64 dev veth2
+ip netns exec r0 ip addr add 10.0.2.254/24 dev veth2
+
+# The neighbours must be resolved for bpf_fib_lookup() to return the MAC
+# addresses; until then the packets take the kernel path, which resolves
+# them.
+
+set +e
+read -r -d '' r0_env <<-EOF
+	# Private BPF filesystem for this bash process, see xdp_icmpv6_drop.sh
+	mount -t bpf bpf /sys/fs/bpf/
+
+	mount -t tracefs nodev /sys/kernel/tracing
+
+        # It allows to load maps with many entries without failing
+        ulimit -l unlimited
+
+	# Attach xdp_prog_router to both ports; netprog also adds them to the
+	# xdp_tx_ports devmap. Run xdp_stats to see XDP_REDIRECT grow.
+	./netprog -q -p xdp_prog_router -i veth1 -i veth2
+
+        /bin/bash
+EOF
+set -e
+
+###################
+#### Node: h1 #####
+###################
+echo -e "\nNode: h1"
+ip netns exec h1 ip link set dev lo up
+ip netns exec h1 ip link set dev veth3 up
+ip netns exec h1 ip addr add 10.0.2.1/24 dev veth3
+ip netns exec h1 ip addr add beef::1/64 dev veth3
+
+ip netns exec h1 ip -4 route add default via 10.0.2.254 dev veth3
+ip netns exec h1 ip -6 route add default via beef::254 dev veth3
+
+ip netns exec h1 ethtool -K veth3 gro on
+
+## Create a new tmux session
+tmux new-session -d -s "${TMUX}" -n h0 ip netns exec h0 bash
+tmux new-window -t "${TMUX}" -n r0 ip netns exec r0 bash -c "${r0_env}"
+tmux new-window -t "${TMUX}" -n h1 ip netns exec h1 bash
+tmux select-window -t :0
+tmux set-option -g mouse on
+tmux attach -t "${TMUX}"